@@ -5,9 +5,14 @@ include(CheckCXXSourceCompiles)
 
 check_include_file(sys/resource.h HAVE_SYS_RESOURCE_H)
 check_symbol_exists(getrusage sys/resource.h HAVE_GETRUSAGE)
+check_symbol_exists(mmap sys/mman.h HAVE_MMAP)
+check_symbol_exists(mprotect sys/mman.h HAVE_MPROTECT)
+check_symbol_exists(sigaction signal.h HAVE_SIGACTION)
+check_symbol_exists(shmat sys/shm.h HAVE_SHMAT)
 check_library_exists(readline readline "" HAVE_LIBREADLINE)
 check_library_exists(rt clock_gettime "" HAVE_LIBRT)
 check_include_file(netinet/in.h HAVE_NETINET_IN_H)
+check_include_file(pthread.h HAVE_PTHREAD_H)
 
 CHECK_CXX_SOURCE_COMPILES("
 template <bool x> struct static_assert;
@@ -61,6 +61,7 @@ arch_6502_init(cpu_t *cpu, cpu_archinfo_t *info, cpu_archrf_t *rf)
 
 	rf->pc = &reg->pc;
 	rf->grf = reg;
+	rf->grf_size = sizeof(reg_6502_t);
 }
 
 static void
@@ -100,10 +101,14 @@ arch_func_t arch_func_6502 = {
 	arch_6502_get_pc,
 	NULL, //emit_decode_reg
 	NULL, //spill_reg_state
+	NULL, //reload_reg_state
 	arch_6502_tag_instr,
 	arch_6502_disasm_instr,
 	arch_6502_translate_cond,
 	arch_6502_translate_instr,
+	NULL, //jump_table
+	arch_6502_cycles,
+	arch_6502_translate_fused,
 	// idbg support
 	arch_6502_get_psr,
 	arch_6502_get_reg,
@@ -297,3 +297,52 @@ get_length(int addmode) {
 	}
 	return -1; //XXX error
 }
+
+/* cycles per opcode, without page crossings and taken branches */
+static uint8_t const cycles_table[256] = {
+/*	 0  1  2  3  4  5  6  7  8  9  A  B  C  D  E  F */
+	 7, 6, 2, 8, 3, 3, 5, 5, 3, 2, 2, 2, 4, 4, 6, 6, /* 0 */
+	 2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7, /* 1 */
+	 6, 6, 2, 8, 3, 3, 5, 5, 4, 2, 2, 2, 4, 4, 6, 6, /* 2 */
+	 2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7, /* 3 */
+	 6, 6, 2, 8, 3, 3, 5, 5, 3, 2, 2, 2, 3, 4, 6, 6, /* 4 */
+	 2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7, /* 5 */
+	 6, 6, 2, 8, 3, 3, 5, 5, 4, 2, 2, 2, 5, 4, 6, 6, /* 6 */
+	 2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7, /* 7 */
+	 2, 6, 2, 6, 3, 3, 3, 3, 2, 2, 2, 2, 4, 4, 4, 4, /* 8 */
+	 2, 6, 2, 6, 4, 4, 4, 4, 2, 5, 2, 5, 5, 5, 5, 5, /* 9 */
+	 2, 6, 2, 6, 3, 3, 3, 3, 2, 2, 2, 2, 4, 4, 4, 4, /* A */
+	 2, 5, 2, 5, 4, 4, 4, 4, 2, 4, 2, 4, 4, 4, 4, 4, /* B */
+	 2, 6, 2, 8, 3, 3, 5, 5, 2, 2, 2, 2, 4, 4, 6, 6, /* C */
+	 2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7, /* D */
+	 2, 6, 2, 8, 3, 3, 5, 5, 2, 2, 2, 2, 4, 4, 6, 6, /* E */
+	 2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7  /* F */
+};
+
+#define get_cycles(opcode) cycles_table[opcode]
+
+/* whether an indexed read takes a cycle more when it crosses a page */
+static bool
+has_page_penalty(uint8_t opcode) {
+	switch (get_addmode(opcode)) {
+		case ADDMODE_ABSX:
+		case ADDMODE_ABSY:
+		case ADDMODE_INDY:
+			break;
+		default:
+			return false;
+	}
+	switch (get_instr(opcode)) {
+		case INSTR_ADC:
+		case INSTR_AND:
+		case INSTR_CMP:
+		case INSTR_EOR:
+		case INSTR_LDA:
+		case INSTR_LDX:
+		case INSTR_LDY:
+		case INSTR_ORA:
+		case INSTR_SBC:
+			return true;
+	}
+	return false;
+}
@@ -54,3 +54,20 @@ arch_6502_tag_instr(cpu_t *cpu, addr_t pc, tag_t *tag, addr_t *new_pc, addr_t *n
 	return length;
 }
 
+
+/*
+ * cycles of the instruction; a taken branch takes one more, and
+ * another one if it goes to a different page
+ */
+int
+arch_6502_cycles(cpu_t *cpu, addr_t pc, int *taken) {
+	uint8_t opcode = cpu->RAM[pc];
+
+	*taken = 0;
+	if (get_addmode(opcode) == ADDMODE_BRA) {
+		addr_t next_pc = pc + 2;
+		addr_t new_pc = next_pc + (int8_t)cpu->RAM[pc+1];
+		*taken = ((new_pc ^ next_pc) & 0xFF00) ? 2 : 1;
+	}
+	return get_cycles(opcode);
+}
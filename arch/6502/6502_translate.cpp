@@ -26,35 +26,44 @@
 
 #define GEP(a) GetElementPtrInst::Create(cpu->ptr_RAM, a, "", bb)
 
-#define LOAD_RAM8(a) LOAD(GEP(a))
+/* a load from a constant address in read-only memory is a constant */
+static Value *
+arch_6502_load_ram8(cpu_t *cpu, Value *a, BasicBlock *bb)
+{
+	ConstantInt *c = dyn_cast<ConstantInt>(a);
+	if (c != NULL && arch_is_readonly(cpu, c->getZExtValue(), 1))
+		return CONST8(cpu->RAM[c->getZExtValue()]);
+	return LOAD(GEP(a));
+}
+
 /* explicit little endian load of 16 bits */
-#define LOAD_RAM16(a) OR(ZEXT16(LOAD_RAM8(a)), SHL(ZEXT16(LOAD_RAM8(ADD(a, CONST32(1)))), CONST16(8)))
+static Value *
+arch_6502_load_ram16(cpu_t *cpu, Value *a, BasicBlock *bb)
+{
+	ConstantInt *c = dyn_cast<ConstantInt>(a);
+	if (c != NULL && arch_is_readonly(cpu, c->getZExtValue(), 2)) {
+		addr_t ea = c->getZExtValue();
+		return CONST16(cpu->RAM[ea] | cpu->RAM[ea + 1] << 8);
+	}
+	return OR(ZEXT16(arch_6502_load_ram8(cpu, a, bb)),
+		SHL(ZEXT16(arch_6502_load_ram8(cpu, ADD(a, CONST32(1)), bb)), CONST16(8)));
+}
+
+#define LOAD_RAM8(a) arch_6502_load_ram8(cpu, a, bb)
+#define LOAD_RAM16(a) arch_6502_load_ram16(cpu, a, bb)
 
 #define OPERAND_8 cpu->RAM[(pc+1)&0xFFFF]
 #define OPERAND_16 ((cpu->RAM[(pc+1)&0xFFFF] | (cpu->RAM[(pc+2)&0xFFFF]<<8))&0xFFFF)
 
+/* the effective address of a memory operand */
 static Value *
-arch_6502_get_operand_lvalue(cpu_t *cpu, addr_t pc, BasicBlock* bb) {
+arch_6502_get_operand_ea(cpu_t *cpu, addr_t pc, BasicBlock* bb) {
 	int am = get_addmode(cpu->RAM[pc]);
 	Value *index_register_before;
 	Value *index_register_after;
 	bool is_indirect;
 	bool is_8bit_base;
 
-	switch (am) {
-		case ADDMODE_ACC:
-			return ptr_A;
-		case ADDMODE_BRA:
-		case ADDMODE_IMPL:
-			return NULL;
-		case ADDMODE_IMM:
-			{
-			Value *ptr_temp = new AllocaInst(getIntegerType(8), "temp", bb);
-			new StoreInst(CONST8(OPERAND_8), ptr_temp, bb);
-			return ptr_temp;
-			}
-	}
-
 	is_indirect = ((am == ADDMODE_IND) || (am == ADDMODE_INDX) || (am == ADDMODE_INDY));
 	is_8bit_base = !((am == ADDMODE_ABS) || (am == ADDMODE_ABSX) || (am == ADDMODE_ABSY));
 	index_register_before = NULL;
@@ -76,22 +85,64 @@ arch_6502_get_operand_lvalue(cpu_t *cpu, addr_t pc, BasicBlock* bb) {
 	uint16_t base = is_8bit_base? (OPERAND_8):(OPERAND_16);
 	Value *ea = CONST32(base);
 
-	if (index_register_before)
+	/* without an index, ea stays a constant */
+	if (index_register_before) {
 		ea = ADD(ZEXT32(LOAD(index_register_before)), ea);
 
-	/* wrap around in zero page */
-	if (is_8bit_base)
-		ea = AND(ea, CONST32(0x00FF));
-	else if (base >= 0xFF00) /* wrap around in memory */
-		ea = AND(ea, CONST32(0xFFFF));
+		/* wrap around in zero page */
+		if (is_8bit_base)
+			ea = AND(ea, CONST32(0x00FF));
+		else if (base >= 0xFF00) /* wrap around in memory */
+			ea = AND(ea, CONST32(0xFFFF));
+	}
 
 	if (is_indirect)
 		ea = ZEXT32(LOAD_RAM16(ea));
 
+	Value *ea_unindexed = index_register_before ? CONST32(base) : ea;
+
 	if (index_register_after)
 		ea = ADD(ZEXT32(LOAD(index_register_after)), ea);
 
-	return GEP(ea);
+	/* indexed reads take a cycle more when crossing a page */
+	if ((cpu->flags_codegen & CPU_CODEGEN_CYCLES) && has_page_penalty(cpu->RAM[pc]))
+		CYCLES(ICMP_NE(AND(XOR(ea, ea_unindexed), CONST32(0xFF00)), CONST32(0)));
+
+	return ea;
+}
+
+static Value *
+arch_6502_get_operand_lvalue(cpu_t *cpu, addr_t pc, BasicBlock* bb) {
+	switch (get_addmode(cpu->RAM[pc])) {
+		case ADDMODE_ACC:
+			return ptr_A;
+		case ADDMODE_BRA:
+		case ADDMODE_IMPL:
+			return NULL;
+		case ADDMODE_IMM:
+			{
+			Value *ptr_temp = new AllocaInst(getIntegerType(8), "temp", bb);
+			new StoreInst(CONST8(OPERAND_8), ptr_temp, bb);
+			return ptr_temp;
+			}
+	}
+
+	return GEP(arch_6502_get_operand_ea(cpu, pc, bb));
+}
+
+/* the value of the operand; constant if it is in read-only memory */
+static Value *
+arch_6502_get_operand(cpu_t *cpu, addr_t pc, BasicBlock* bb) {
+	switch (get_addmode(cpu->RAM[pc])) {
+		case ADDMODE_ACC:
+		case ADDMODE_BRA:
+		case ADDMODE_IMPL:
+			return LOAD(arch_6502_get_operand_lvalue(cpu, pc, bb));
+		case ADDMODE_IMM:
+			return CONST8(OPERAND_8);
+	}
+
+	return LOAD_RAM8(arch_6502_get_operand_ea(cpu, pc, bb));
 }
 
 static void
@@ -121,7 +172,7 @@ LOG("%s:%d pc=%llx opcode=%x\n", __func__, __LINE__, pc, opcode);
 }
 
 #define LOPERAND arch_6502_get_operand_lvalue(cpu, pc, bb)
-#define OPERAND LOAD(LOPERAND)
+#define OPERAND arch_6502_get_operand(cpu, pc, bb)
 
 /* stack operations */
 #define TOS GEP(OR(ZEXT32(R(S)), CONST32(0x0100)))
@@ -238,3 +289,101 @@ arch_6502_translate_instr(cpu_t *cpu, addr_t pc, BasicBlock *bb) {
 	return get_length(get_addmode(opcode));
 }
 
+
+//////////////////////////////////////////////////////////////////////
+// idioms, see CPU_CODEGEN_FUSE
+//////////////////////////////////////////////////////////////////////
+
+/* an immediate or a byte at a constant address */
+typedef struct {
+	bool imm;
+	uint16_t v;	/* the immediate, or the address */
+} arch_6502_byte_t;
+
+/* skip the instruction at *pc if it is instr, with a constant operand */
+static bool
+arch_6502_fuse_next(cpu_t *cpu, addr_t *ppc, addr_t end, int instr, arch_6502_byte_t *op)
+{
+	addr_t pc = *ppc;
+
+	if (pc >= end)
+		return false;
+	uint8_t opcode = cpu->RAM[pc];
+	if (get_instr(opcode) != instr)
+		return false;
+	switch (get_addmode(opcode)) {
+		case ADDMODE_IMPL:	break;
+		case ADDMODE_IMM:	op->imm = true; op->v = OPERAND_8; break;
+		case ADDMODE_ZP:	op->imm = false; op->v = OPERAND_8; break;
+		case ADDMODE_ABS:	op->imm = false; op->v = OPERAND_16; break;
+		default:			return false;
+	}
+	*ppc = pc + get_length(get_addmode(opcode));
+	return true;
+}
+
+static Value *
+arch_6502_fuse_load(cpu_t *cpu, arch_6502_byte_t const *op, BasicBlock *bb)
+{
+	return op->imm ? CONST8(op->v) : LOAD_RAM8(CONST32(op->v));
+}
+
+/*
+ * 16 bit add or subtract:
+ *	clc		(or sec and sbc)
+ *	lda	a
+ *	adc	b
+ *	sta	c
+ *	lda	a+1
+ *	adc	b+1
+ *	sta	c+1
+ * The carry goes from the low byte to the high byte in a host
+ * register, and only the last ADC sets the flags. The CLC may also
+ * follow the first LDA. The low byte of the result must not be
+ * stored where the high byte operands are read from.
+ */
+int
+arch_6502_translate_fused(cpu_t *cpu, addr_t pc, addr_t end, BasicBlock **bb_ptr)
+{
+	BasicBlock *bb = *bb_ptr;
+	arch_6502_byte_t a0, b0, c0, a1, b1, c1;
+	addr_t p = pc;
+	bool sub;
+
+	bool lda_first = arch_6502_fuse_next(cpu, &p, end, INSTR_LDA, &a0);
+	if (arch_6502_fuse_next(cpu, &p, end, INSTR_CLC, NULL))
+		sub = false;
+	else if (arch_6502_fuse_next(cpu, &p, end, INSTR_SEC, NULL))
+		sub = true;
+	else
+		return 0;
+
+	int op = sub ? INSTR_SBC : INSTR_ADC;
+	if ((!lda_first && !arch_6502_fuse_next(cpu, &p, end, INSTR_LDA, &a0)) ||
+		!arch_6502_fuse_next(cpu, &p, end, op, &b0) ||
+		!arch_6502_fuse_next(cpu, &p, end, INSTR_STA, &c0) ||
+		!arch_6502_fuse_next(cpu, &p, end, INSTR_LDA, &a1) ||
+		!arch_6502_fuse_next(cpu, &p, end, op, &b1) ||
+		!arch_6502_fuse_next(cpu, &p, end, INSTR_STA, &c1))
+		return 0;
+	if ((!a1.imm && a1.v == c0.v) || (!b1.imm && b1.v == c0.v))
+		return 0;
+
+	Value *v_b0 = arch_6502_fuse_load(cpu, &b0, bb);
+	Value *v_b1 = arch_6502_fuse_load(cpu, &b1, bb);
+	if (sub) {
+		v_b0 = COM(v_b0);
+		v_b1 = COM(v_b1);
+	}
+	Value *lo = ADD(ADD(ZEXT16(arch_6502_fuse_load(cpu, &a0, bb)), ZEXT16(v_b0)),
+		CONST16(sub ? 1 : 0));
+	Value *hi = ADD(ADD(ZEXT16(arch_6502_fuse_load(cpu, &a1, bb)), ZEXT16(v_b1)),
+		LSHR(lo, CONST16(8)));
+
+	STORE(TRUNC8(lo), GEP(CONST32(c0.v)));
+	STORE(TRUNC8(hi), GEP(CONST32(c1.v)));
+	LET1(cpu->ptr_C, TRUNC1(LSHR(hi, CONST16(8))));
+	SET_NZ(LET(A, TRUNC8(hi)));
+
+	return p - pc;
+}
@@ -45,6 +45,7 @@ arch_arm_init(cpu_t *cpu, cpu_archinfo_t *info, cpu_archrf_t *rf)
 
 	cpu->rf.pc = &reg->r[15];
 	cpu->rf.grf = reg;
+	cpu->rf.grf_size = sizeof(reg_arm_t);
 
 	// allocate space for CC flags.
 	cpu->feptr = malloc(sizeof(ccarm_t));
@@ -86,10 +87,14 @@ arch_func_t arch_func_arm = {
 	arch_arm_get_pc,
 	arch_arm_emit_decode_reg,
 	arch_arm_spill_reg_state,
+	arch_arm_reload_reg_state,
 	arch_arm_tag_instr,
 	arch_arm_disasm_instr,
 	arch_arm_translate_cond,
 	arch_arm_translate_instr,
+	NULL, // jump_table
+	NULL, // cycles
+	arch_arm_translate_fused,
 	// idbg support
 	arch_arm_get_psr,
 	arch_arm_get_reg,
@@ -200,6 +200,13 @@ LOG("%s:%d pc=%llx\n", __func__, __LINE__, pc);
 
 	switch ((instr >> 26) & 3) { /* bits 26 and 27 */
 		case 0:
+			if ((instr & 0x0FB00FF0) == 0x01000090) { /* SWP/SWPB */
+				if (BIT(22))
+					LET(RD, ZEXT32(XCHG8(R(RM), R(RN))));
+				else
+					LET(RD, XCHG32(R(RM), R(RN)));
+				break;
+			}
 			switch(opcode) {
 				case 2:
 					{
@@ -294,6 +301,55 @@ LOG("%s:%d pc=%llx\n", __func__, __LINE__, pc);
 	return 4;
 }
 
+//////////////////////////////////////////////////////////////////////
+// idioms, see CPU_CODEGEN_FUSE
+//////////////////////////////////////////////////////////////////////
+
+/*
+ * A run of conditionally executed instructions, as after a compare:
+ *	cmp	r0, r1
+ *	moveq	r2, #1
+ *	movne	r2, #0
+ * One by one, every instruction tests its condition and ends a basic
+ * block. The run tests the condition once; the instructions with it
+ * go into one block, those with the opposite condition into another.
+ * None of them may set the flags or the PC.
+ */
+int
+arch_arm_translate_fused(cpu_t *cpu, addr_t pc, addr_t end, BasicBlock **bb_ptr)
+{
+	BasicBlock *bb = *bb_ptr;
+	uint32_t instr = *(uint32_t*)&cpu->RAM[pc];
+	unsigned cond = instr >> 28;
+	addr_t a;
+
+	if (cond >= 0xE) /* AL, NV */
+		return 0;
+	for (a = pc; a < end; a += 4) {
+		instr = *(uint32_t*)&cpu->RAM[a];
+		if ((instr >> 29) != (cond >> 1)) /* neither cond nor its opposite */
+			break;
+		if (BITS(26,27) == 0 && (S || RD == 15))
+			break;
+	}
+	if (a - pc < 8)
+		return 0;
+
+	BasicBlock *bb_then = BasicBlock::Create(_CTX(), "", cpu->cur_func, 0);
+	BasicBlock *bb_else = BasicBlock::Create(_CTX(), "", cpu->cur_func, 0);
+	BasicBlock *bb_join = BasicBlock::Create(_CTX(), "", cpu->cur_func, 0);
+	BranchInst::Create(bb_then, bb_else, arch_arm_translate_cond(cpu, pc, bb), bb);
+	for (addr_t i = pc; i < a; i += 4) {
+		instr = *(uint32_t*)&cpu->RAM[i];
+		arch_arm_translate_instr(cpu, i, (instr >> 28) == cond ? bb_then : bb_else);
+	}
+	BranchInst::Create(bb_join, bb_then);
+	BranchInst::Create(bb_join, bb_else);
+
+	*bb_ptr = bb_join;
+	return a - pc;
+}
+
 #define N_SHIFT 31
 #define Z_SHIFT 30
 #define C_SHIFT 29
@@ -345,5 +401,12 @@ arch_arm_spill_reg_state(cpu_t *cpu, BasicBlock *bb)
 	Value *flags = arch_arm_flags_encode(cpu, bb);
 	new StoreInst(flags, ptr_CPSR, false, bb);
 }
+
+void
+arch_arm_reload_reg_state(cpu_t *cpu, BasicBlock *bb)
+{
+	Value *flags = new LoadInst(ptr_CPSR, "", false, bb);
+	arch_arm_flags_decode(cpu, flags, bb);
+}
 //printf("%s:%d PC=$%04X\n", __func__, __LINE__, pc);
 //printf("%s:%d\n", __func__, __LINE__);
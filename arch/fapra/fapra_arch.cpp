@@ -34,6 +34,7 @@ arch_fapra_init(cpu_t *cpu, cpu_archinfo_t *info, cpu_archrf_t *rf)
 
 	cpu->rf.pc = &reg->pc;
 	cpu->rf.grf = reg;
+	cpu->rf.grf_size = sizeof(reg_fapra32_t);
 
 	LOG("%d bit FAPRA initialized.\n", info->word_size);
 }
@@ -73,10 +74,14 @@ arch_func_t arch_func_fapra = {
 	arch_fapra_get_pc,
 	NULL, /* emit_decode_reg */
 	NULL, /* spill_reg_state */
+	NULL, /* reload_reg_state */
 	arch_fapra_tag_instr,
 	arch_fapra_disasm_instr,
 	arch_fapra_translate_cond,
 	arch_fapra_translate_instr,
+	NULL, /* jump_table */
+	NULL, /* cycles */
+	NULL, /* translate_fused */
 	// idbg support
 	arch_fapra_get_psr,
 	arch_fapra_get_reg,
@@ -37,6 +37,7 @@ arch_m68k_init(cpu_t *cpu, cpu_archinfo_t *info, cpu_archrf_t *rf)
 
   rf->pc = &reg->pc;
   rf->grf = reg;
+  rf->grf_size = sizeof(reg_m68k_t);
 }
 
 static addr_t
@@ -67,10 +68,14 @@ arch_func_t arch_func_m68k = {
 	arch_m68k_get_pc,
 	NULL, /* emit_decode_reg */
 	NULL, /* spill_reg_state */
+	NULL, /* reload_reg_state */
 	arch_m68k_tag_instr,
 	arch_m68k_disasm_instr,
 	arch_m68k_translate_cond,
 	arch_m68k_translate_instr,
+	NULL, /* jump_table */
+	NULL, /* cycles */
+	NULL, /* translate_fused */
 	// idbg support
 	arch_m68k_get_psr,
 	arch_m68k_get_reg,
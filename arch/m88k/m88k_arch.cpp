@@ -69,6 +69,8 @@ arch_m88k_init(cpu_t *cpu, cpu_archinfo_t *info, cpu_archrf_t *rf)
 	rf->pc = &reg->sxip;
 	rf->grf = reg;
 	rf->frf = fp_reg;
+	rf->grf_size = sizeof(m88k_grf_t);
+	rf->frf_size = sizeof(m88k_xrf_t);
 	rf->vrf = NULL;
 
 	LOG("Motorola 88110 initialized.\n");
@@ -123,6 +125,13 @@ arch_m88k_spill_reg_state(cpu_t *cpu, BasicBlock *bb)
 	new StoreInst(flags, cpu->ptr_PSR, false, bb);
 }
 
+static void
+arch_m88k_reload_reg_state(cpu_t *cpu, BasicBlock *bb)
+{
+	Value *flags = new LoadInst(cpu->ptr_PSR, "", false, bb);
+	arch_m88k_flags_decode(cpu, flags, bb);
+}
+
 static uint64_t
 arch_m88k_get_psr(cpu_t *, void *regs)
 {
@@ -155,10 +164,14 @@ arch_func_t arch_func_m88k = {
 	arch_m88k_get_pc,
 	arch_m88k_emit_decode_reg,
 	arch_m88k_spill_reg_state,
+	arch_m88k_reload_reg_state,
 	arch_m88k_tag_instr,
 	arch_m88k_disasm_instr,
 	arch_m88k_translate_cond,
 	arch_m88k_translate_instr,
+	arch_m88k_jump_table,
+	NULL, /* cycles */
+	NULL, /* translate_fused */
 	// idbg support
 	arch_m88k_get_psr,
 	arch_m88k_get_reg,
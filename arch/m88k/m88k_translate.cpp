@@ -42,6 +42,130 @@ arch_m88k_fix_return_pc(m88k_insn const &insn, addr_t *next_pc)
 	}
 }
 
+/* instructions searched backwards for the parts of a jump table idiom */
+#define JT_WINDOW 16
+
+/* the GPR an instruction writes, or 0 */
+static unsigned
+m88k_dest_reg(m88k_insn const &insn)
+{
+	switch (insn.opcode()) {
+		case M88K_OPC_ILLEGAL:
+		case M88K_OPC_ST:
+		case M88K_OPC_ST_B:
+		case M88K_OPC_ST_H:
+		case M88K_OPC_ST_D:
+		case M88K_OPC_ST_X:
+		case M88K_OPC_BR:
+		case M88K_OPC_BR_N:
+		case M88K_OPC_BB0:
+		case M88K_OPC_BB0_N:
+		case M88K_OPC_BB1:
+		case M88K_OPC_BB1_N:
+		case M88K_OPC_BCND:
+		case M88K_OPC_BCND_N:
+		case M88K_OPC_JMP:
+		case M88K_OPC_JMP_N:
+		case M88K_OPC_TB0:
+		case M88K_OPC_TB1:
+		case M88K_OPC_TBND:
+		case M88K_OPC_TCND:
+			return 0;
+		case M88K_OPC_BSR:
+		case M88K_OPC_BSR_N:
+		case M88K_OPC_JSR:
+		case M88K_OPC_JSR_N:
+			return 1;
+		default:
+			return insn.rd();
+	}
+}
+
+/* the closest instruction before *pc that writes reg */
+static bool
+m88k_find_def(cpu_t *cpu, addr_t *pc, unsigned reg, m88k_insn *def)
+{
+	if (reg == 0)
+		return false;
+	for (int i = 0; i < JT_WINDOW && is_inside_code_area(cpu, *pc - 4); i++) {
+		*pc -= 4;
+		m88k_insn insn = INSTR(*pc);
+		if (m88k_dest_reg(insn) == reg) {
+			*def = insn;
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * The jump table idiom of compiled switch statements:
+ *
+ *	cmp	rc, ri, n - 1
+ *	bb1	hi, rc, default
+ *	or.u	rb, r0, hi16(table)
+ *	or	rb, rb, lo16(table)
+ *	ld	rt, rb[ri]
+ *	jmp	rt
+ *
+ * Returns the number of table entries and stores up to max of them
+ * in targets; 0 if the JMP at pc is not such a jump.
+ */
+int
+arch_m88k_jump_table(cpu_t *cpu, addr_t pc, addr_t *targets, int max)
+{
+	m88k_insn insn = INSTR(pc);
+	addr_t def_pc = pc;
+
+	// jmp rt; jmp r1 is a return
+	if ((insn.opcode() != M88K_OPC_JMP && insn.opcode() != M88K_OPC_JMP_N) ||
+		insn.rs2() == 1)
+		return 0;
+
+	// ld rt, rb[ri]
+	if (!m88k_find_def(cpu, &def_pc, insn.rs2(), &insn) ||
+		insn.opcode() != M88K_OPC_LD || insn.format() != M88K_TFMT_REGS)
+		return 0;
+	unsigned base = insn.rs1(), index = insn.rs2();
+	addr_t ld_pc = def_pc;
+
+	// or.u rb, r0, hi16(table); or rb, rb, lo16(table)
+	uint32_t table = 0;
+	if (!m88k_find_def(cpu, &def_pc, base, &insn))
+		return 0;
+	if (insn.opcode() == M88K_OPC_OR && insn.format() == M88K_IFMT_REG &&
+		insn.rs1() == base) {
+		table = (uint16_t)insn.immediate();
+		if (!m88k_find_def(cpu, &def_pc, base, &insn))
+			return 0;
+	}
+	if (insn.opcode() != M88K_OPC_OR_U || insn.format() != M88K_IFMT_REG ||
+		insn.rs1() != 0)
+		return 0;
+	table |= (uint32_t)(uint16_t)insn.immediate() << 16;
+
+	// cmp rc, ri, n - 1; ri must not change in between
+	int n = 0;
+	for (int i = 0; i < JT_WINDOW && is_inside_code_area(cpu, ld_pc - 4); i++) {
+		ld_pc -= 4;
+		insn = INSTR(ld_pc);
+		if (insn.opcode() == M88K_OPC_CMP && insn.format() == M88K_IFMT_REG &&
+			insn.rs1() == index) {
+			n = (uint16_t)insn.immediate() + 1;
+			break;
+		}
+		if (m88k_dest_reg(insn) == index)
+			break;
+	}
+	if (n <= 0 || n > JUMP_TABLE_MAX || !is_inside_code_area(cpu, table) ||
+		!is_inside_code_area(cpu, table + n * 4 - 1))
+		return 0;
+
+	for (int i = 0; i < n && i < max; i++)
+		targets[i] = INSTR(table + i * 4);
+	return n;
+}
+
 int arch_m88k_tag_instr(cpu_t *cpu, addr_t pc, tag_t *tag, addr_t *new_pc, addr_t *next_pc)
 {
 	m88k_insn instr = INSTR(pc);
@@ -53,7 +177,11 @@ int arch_m88k_tag_instr(cpu_t *cpu, addr_t pc, tag_t *tag, addr_t *new_pc, addr_
 
 		case M88K_OPC_JMP:
 		case M88K_OPC_JMP_N:
-			*tag = TAG_RET;
+			if (arch_m88k_jump_table(cpu, pc, NULL, 0) > 0) {
+				*new_pc = NEW_PC_NONE;
+				*tag = TAG_BRANCH;
+			} else
+				*tag = TAG_RET;
 			break;
 
 		case M88K_OPC_JSR:
@@ -705,29 +833,19 @@ arch_m88k_fcmp(cpu_t *cpu, m88k_reg_t rdst, Value *src1, Value *src2, BasicBlock
 /*
  * Exchange Register/Memory (Word/Byte)
  *
- * NOTE: This operation locks the bus, so when we'll go system
- * emulation, this operation must be atomic.
+ * This operation locks the bus, so it is atomic against other
+ * cpus running on the same RAM.
  */
 static void
 arch_m88k_xmem(cpu_t *cpu, bool byte, m88k_reg_t rd, Value *src1, Value *src2, BasicBlock *bb)
 {
-	Value *reg_value;
 	Value *mem_value;
-	Value *address;
 
-	reg_value = R32(rd);
-	if (byte) {
-		address = ADD(src1, src2);
-		mem_value = arch_load8(cpu, address, bb);
-	} else {
-		address = ADD(src1, SHL(src2, CONST32(2)));
-		mem_value = arch_load32_aligned(cpu, address, bb);
-	}
-	LET32(rd, mem_value);
 	if (byte)
-		STORE8(reg_value, address);
+		mem_value = ZEXT32(XCHG8(R32(rd), ADD(src1, src2)));
 	else
-		STORE32(reg_value, address);
+		mem_value = XCHG32(R32(rd), ADD(src1, SHL(src2, CONST32(2))));
+	LET32(rd, mem_value);
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -51,6 +51,7 @@ arch_mips_init(cpu_t *cpu, cpu_archinfo_t *info, cpu_archrf_t *rf)
 
 		cpu->rf.pc = &reg->pc;
 		cpu->rf.grf = reg;
+		cpu->rf.grf_size = sizeof(reg_mips64_t);
 	} else {
 		reg_mips32_t *reg;
 		reg = (reg_mips32_t*)malloc(sizeof(reg_mips32_t));
@@ -60,6 +61,7 @@ arch_mips_init(cpu_t *cpu, cpu_archinfo_t *info, cpu_archrf_t *rf)
 
 		cpu->rf.pc = &reg->pc;
 		cpu->rf.grf = reg;
+		cpu->rf.grf_size = sizeof(reg_mips32_t);
 	}
 
 	LOG("%d bit MIPS initialized.\n", info->word_size);
@@ -105,10 +107,14 @@ arch_func_t arch_func_mips = {
 	arch_mips_get_pc,
 	NULL, /* emit_decode_reg */
 	NULL, /* spill_reg_state */
+	NULL, /* reload_reg_state */
 	arch_mips_tag_instr,
 	arch_mips_disasm_instr,
 	arch_mips_translate_cond,
 	arch_mips_translate_instr,
+	arch_mips_jump_table,
+	NULL, /* cycles */
+	arch_mips_translate_fused,
 	// idbg support
 	arch_mips_get_psr,
 	arch_mips_get_reg,
@@ -36,6 +36,163 @@ using namespace llvm;
 //////////////////////////////////////////////////////////////////////
 
 #include "tag.h"
+
+/* instructions searched backwards for the parts of a jump table idiom */
+#define JT_WINDOW 16
+
+/* the GPR an instruction writes, or 0 */
+static unsigned
+mips_dest_reg(uint32_t instr)
+{
+	switch (instr >> 26) {
+		case 0x00: //INCPU_SPECIAL
+			switch (instr & 0x3F) {
+				case 0x08: //INCPUS_JR
+				case 0x0C: //INCPUS_SYSCALL
+				case 0x0D: //INCPUS_BREAK
+				case 0x0F: //INCPUS_SYNC
+				case 0x11: //INCPUS_MTHI
+				case 0x13: //INCPUS_MTLO
+				case 0x18: //INCPUS_MULT
+				case 0x19: //INCPUS_MULTU
+				case 0x1A: //INCPUS_DIV
+				case 0x1B: //INCPUS_DIVU
+					return 0;
+				default:
+					return RD;
+			}
+		case 0x01: //INCPU_REGIMM
+			return (RT & 0x10) ? 31 : 0;
+		case 0x03: //INCPU_JAL
+			return 31;
+		case 0x10: //INCPU_COP0
+		case 0x11: //INCPU_COP1
+		case 0x12: //INCPU_COP2
+		case 0x13: //INCPU_COP3
+			return (RS == 0x00 || RS == 0x02) ? RT : 0; /* MFCz, CFCz */
+		default:
+			if ((instr >> 26) >= 0x08 && (instr >> 26) <= 0x0F)
+				return RT;	/* immediate ALU ops, LUI */
+			if ((instr >> 26) >= 0x20 && (instr >> 26) <= 0x27)
+				return RT;	/* loads */
+			return 0;
+	}
+}
+
+/* the closest instruction before *pc that writes reg */
+static bool
+mips_find_def(cpu_t *cpu, addr_t *pc, unsigned reg, uint32_t *def)
+{
+	if (reg == 0)
+		return false;
+	for (int i = 0; i < JT_WINDOW && is_inside_code_area(cpu, *pc - 4); i++) {
+		*pc -= 4;
+		uint32_t instr = INSTR(*pc);
+		if (mips_dest_reg(instr) == reg) {
+			*def = instr;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* the address in reg, if it is loaded by LUI (+ ADDIU/ORI) */
+static bool
+mips_find_address(cpu_t *cpu, addr_t pc, unsigned reg, uint32_t *address)
+{
+	uint32_t instr;
+
+	if (!mips_find_def(cpu, &pc, reg, &instr))
+		return false;
+	if ((instr >> 26) == 0x0F) { //INCPU_LUI
+		*address = GetImmediate << 16;
+		return true;
+	}
+	if ((instr >> 26) != 0x09 && (instr >> 26) != 0x0D) //INCPU_ADDIU, INCPU_ORI
+		return false;
+
+	uint32_t lo = (instr >> 26) == 0x09 ? (uint32_t)(sint16_t)GetImmediate : GetImmediate;
+	reg = RS;
+	if (!mips_find_def(cpu, &pc, reg, &instr) || (instr >> 26) != 0x0F)
+		return false;
+	*address = (GetImmediate << 16) + lo;
+	return true;
+}
+
+/*
+ * The jump table idiom of compiled switch statements:
+ *
+ *	sltiu	rc, ri, n
+ *	beqz	rc, default
+ *	sll	rs, ri, 2
+ *	lui	rb, %hi(table)
+ *	addiu	rb, rb, %lo(table)	(or in the offset of the LW)
+ *	addu	rt, rs, rb
+ *	lw	rt, offset(rt)
+ *	jr	rt
+ *
+ * Returns the number of table entries and stores up to max of them
+ * in targets; 0 if the JR at pc is not such a jump.
+ */
+int
+arch_mips_jump_table(cpu_t *cpu, addr_t pc, addr_t *targets, int max)
+{
+	uint32_t instr = INSTR(pc);
+	addr_t def_pc = pc;
+
+	// jr rt
+	if ((instr >> 26) != 0x00 || (instr & 0x3F) != 0x08)
+		return 0;
+
+	// lw rt, offset(rt)
+	if (!mips_find_def(cpu, &def_pc, RS, &instr) || (instr >> 26) != 0x23)
+		return 0;
+	uint32_t table = (uint32_t)(sint16_t)GetImmediate;
+
+	// addu rt, rs, rb
+	if (!mips_find_def(cpu, &def_pc, RS, &instr) ||
+		(instr >> 26) != 0x00 || (instr & 0x3F) != 0x21)
+		return 0;
+
+	unsigned regs[2] = { RS, RT };
+	for (int i = 0; i < 2; i++) {
+		uint32_t base;
+		addr_t sll_pc = def_pc;
+
+		// sll rs, ri, 2
+		if (!mips_find_def(cpu, &sll_pc, regs[i], &instr) ||
+			(instr >> 26) != 0x00 || (instr & 0x3F) != 0x00 || GetSA != 2)
+			continue;
+		unsigned index = RT;
+
+		// lui rb, %hi(table) ...
+		if (!mips_find_address(cpu, def_pc, regs[1 - i], &base))
+			continue;
+		table += base;
+
+		// sltiu rc, ri, n; ri must not change in between
+		int n = 0;
+		for (int j = 0; j < JT_WINDOW && is_inside_code_area(cpu, sll_pc - 4); j++) {
+			sll_pc -= 4;
+			instr = INSTR(sll_pc);
+			if ((instr >> 26) == 0x0B && RS == index) {
+				n = (uint32_t)(sint32_t)(sint16_t)GetImmediate;
+				break;
+			}
+			if (mips_dest_reg(instr) == index)
+				break;
+		}
+		if (n <= 0 || n > JUMP_TABLE_MAX || !is_inside_code_area(cpu, table) ||
+			!is_inside_code_area(cpu, table + n * 4 - 1))
+			return 0;
+
+		for (int j = 0; j < n && j < max; j++)
+			targets[j] = INSTR(table + j * 4);
+		return n;
+	}
+	return 0;
+}
+
 int arch_mips_tag_instr(cpu_t *cpu, addr_t pc, tag_t *tag, addr_t *new_pc, addr_t *next_pc) {
 	uint32_t instr = INSTR(pc);
 
@@ -44,7 +201,11 @@ int arch_mips_tag_instr(cpu_t *cpu, addr_t pc, tag_t *tag, addr_t *new_pc, addr_
 			switch(instr & 0x3F) {
 				case 0x08: //INCPUS_JR
 					//XXX is not necessarily a return!
-					*tag = TAG_RET | TAG_DELAY_SLOT;
+					if (arch_mips_jump_table(cpu, pc, NULL, 0) > 0) {
+						*new_pc = NEW_PC_NONE;
+						*tag = TAG_BRANCH | TAG_DELAY_SLOT;
+					} else
+						*tag = TAG_RET | TAG_DELAY_SLOT;
 					break;
 				case 0x09:  //INCPUS_JALR
 					*new_pc = NEW_PC_NONE;
@@ -352,7 +513,7 @@ arch_mips_translate_instr(cpu_t *cpu, addr_t pc, BasicBlock *bb)
 			}
 			case 0x0C: /* INCPUS_SYSCALL */	BAD;
 			case 0x0D: /* INCPUS_BREAK */	BAD;
-			case 0x0F: /* INCPUS_SYNC */	BAD;
+			case 0x0F: /* INCPUS_SYNC */	arch_memory_barrier(cpu, bb);	break;
 			case 0x10: /* INCPUS_MFHI */	BAD;
 			case 0x11: /* INCPUS_MTHI */	BAD;
 			case 0x12: /* INCPUS_MFLO */	BAD;
@@ -531,12 +692,12 @@ arch_mips_translate_instr(cpu_t *cpu, addr_t pc, BasicBlock *bb)
 	case 0x2D: /* INCPU_SDR */	BAD;
 	case 0x2E: /* INCPU_SWR */	BAD;
 	case 0x2F: /* INCPU_CACHE */	break; /* no-op */
-	case 0x30: /* INCPU_LL */		break; /* no-op */
+	case 0x30: /* INCPU_LL */		LOAD_LINKED32(RT,ADD(R32(RS),IMM32));					break;
 	case 0x31: /* INCPU_LWC1 */	BAD;
 	case 0x34: /* INCPU_LLD */		break; /* no-op */
 	case 0x35: /* INCPU_LDC1 */	BAD;
 	case 0x37: /* INCPU_LD */	BAD;
-	case 0x38: /* INCPU_SC */		break; /* no-op */
+	case 0x38: /* INCPU_SC */		LET32(RT,ZEXT32(STORE_COND32(R32(RT),ADD(R32(RS),IMM32))));	break;
 	case 0x39: /* INCPU_SWC1 */	BAD;
 	case 0x3C: /* INCPU_SCD */	BAD;
 	case 0x3D: /* INCPU_SDC1 */	BAD;
@@ -553,3 +714,70 @@ arch_mips_translate_instr(cpu_t *cpu, addr_t pc, BasicBlock *bb)
 
 //printf("%s:%d PC=$%04X\n", __func__, __LINE__, pc);
 //printf("%s:%d\n", __func__, __LINE__);
+
+//////////////////////////////////////////////////////////////////////
+// idioms, see CPU_CODEGEN_FUSE
+//////////////////////////////////////////////////////////////////////
+
+/*
+ * LUI followed by an instruction that completes the constant in its
+ * register (ORI, ADDIU) or uses it as the base of a load or store:
+ *	lui	v0, %hi(x)
+ *	lw	v0, %lo(x)(v0)
+ * The address is a constant then, so loads from read-only memory
+ * are folded. If the second instruction overwrites the register,
+ * the LUI result is not stored.
+ */
+int
+arch_mips_translate_fused(cpu_t *cpu, addr_t pc, addr_t end, BasicBlock **bb_ptr)
+{
+	BasicBlock *bb = *bb_ptr;
+	uint32_t instr = INSTR(pc);
+
+	if ((instr >> 26) != 0x0F || RT == 0 || pc + 8 > end) /* INCPU_LUI */
+		return 0;
+	unsigned reg = RT;
+	uint64_t hi = (uint64_t)GetImmediate << 16;
+
+	instr = INSTR(pc + 4);
+	if (RS != reg)
+		return 0;
+	bool store;
+	switch (instr >> 26) {
+		case 0x09: /* INCPU_ADDIU */
+		case 0x0D: /* INCPU_ORI */
+		case 0x20: /* INCPU_LB */
+		case 0x21: /* INCPU_LH */
+		case 0x23: /* INCPU_LW */
+		case 0x24: /* INCPU_LBU */
+		case 0x25: /* INCPU_LHU */
+			store = false;
+			break;
+		case 0x28: /* INCPU_SB */
+		case 0x29: /* INCPU_SH */
+		case 0x2B: /* INCPU_SW */
+			store = true;
+			break;
+		default:
+			return 0;
+	}
+
+	if (store || RT != reg)
+		LET(reg, CONST(hi));
+
+	Value *ea = CONST32((uint32_t)hi + (uint32_t)(sint32_t)(sint16_t)GetImmediate);
+	switch (instr >> 26) {
+	case 0x09: /* INCPU_ADDIU */	LET32(RT, ea);						break;
+	case 0x0D: /* INCPU_ORI */		LET(RT, CONST(hi | GetImmediate));	break;
+	case 0x20: /* INCPU_LB */		LOAD8S(RT, ea);						break;
+	case 0x21: /* INCPU_LH */		LOAD16S(RT, ea);					break;
+	case 0x23: /* INCPU_LW */		LOAD32(RT, ea);						break;
+	case 0x24: /* INCPU_LBU */		LOAD8(RT, ea);						break;
+	case 0x25: /* INCPU_LHU */		LOAD16(RT, ea);						break;
+	case 0x28: /* INCPU_SB */		STORE8(R(RT), ea);					break;
+	case 0x29: /* INCPU_SH */		STORE16(R(RT), ea);					break;
+	case 0x2B: /* INCPU_SW */		STORE32(R(RT), ea);					break;
+	}
+
+	return 8;
+}
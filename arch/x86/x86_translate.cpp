@@ -59,6 +59,7 @@ arch_8086_init(cpu_t *cpu, cpu_archinfo_t *info, cpu_archrf_t *rf)
 
 	rf->pc	= &reg->ip;
 	rf->grf	= reg;
+	rf->grf_size = sizeof(reg_8086_t);
 }
 
 static void
@@ -102,10 +103,14 @@ arch_func_t arch_func_8086 = {
 	arch_8086_get_pc,
 	arch_8086_emit_decode_reg,
 	arch_8086_spill_reg_state,
+	NULL, // reload_reg_state
 	arch_8086_tag_instr,
 	arch_8086_disasm_instr,
 	arch_8086_translate_cond,
 	arch_8086_translate_instr,
+	NULL, // jump_table
+	NULL, // cycles
+	NULL, // translate_fused
 	// idbg support
 	arch_8086_get_psr,
 	arch_8086_get_reg,
@@ -40,6 +40,15 @@ emit_store_pc_return(cpu_t *cpu, BasicBlock *bb_branch, addr_t new_pc, BasicBloc
 	BranchInst::Create(bb_ret, bb_branch);
 }
 
+/* leave the function with a specific exit code */
+void
+emit_store_pc_exit(cpu_t *cpu, BasicBlock *bb_branch, addr_t new_pc, Value *exit_code, BasicBlock *bb_ret)
+{
+	emit_store_pc(cpu, bb_branch, new_pc);
+	new StoreInst(exit_code, cpu->ptr_exit_code, bb_branch);
+	BranchInst::Create(bb_ret, bb_branch);
+}
+
 BasicBlock *
 create_basicblock(cpu_t *cpu, addr_t addr, Function *f, uint8_t bb_type) {
 	char label[17];
@@ -2,7 +2,12 @@ enum {
 	BB_TYPE_NORMAL   = 'L', /* basic block for instructions */
 	BB_TYPE_COND     = 'C', /* basic block for "taken" case of cond. execution */
 	BB_TYPE_DELAY    = 'D', /* basic block for delay slot in non-taken case of cond. exec. */
-	BB_TYPE_EXTERNAL = 'E'  /* basic block for unknown addresses; just traps */
+	BB_TYPE_EXTERNAL = 'E', /* basic block for unknown addresses; just traps */
+	BB_TYPE_BODY     = 'B', /* basic block for instructions, if 'L' holds the block entry checks */
+	BB_TYPE_EXIT     = 'X', /* basic block for leaving before the instructions are executed */
+	BB_TYPE_TRAP     = 'T', /* basic block for calling the trap function */
+	BB_TYPE_LOOP     = 'O', /* basic block for instructions, in the copy of a loop */
+	BB_TYPE_IDLE     = 'I'  /* basic block for leaving an idle loop */
 };
 
 bool is_start_of_basicblock(cpu_t *cpu, addr_t a);
@@ -11,3 +16,4 @@ BasicBlock *create_basicblock(cpu_t *cpu, addr_t addr, Function *f, uint8_t bb_t
 const BasicBlock *lookup_basicblock(cpu_t *cpu, Function* f, addr_t pc, BasicBlock *bb_ret, uint8_t bb_type);
 void emit_store_pc(cpu_t *cpu, BasicBlock *bb_branch, addr_t new_pc);
 void emit_store_pc_return(cpu_t *cpu, BasicBlock *bb_branch, addr_t new_pc, BasicBlock *bb_ret);
+void emit_store_pc_exit(cpu_t *cpu, BasicBlock *bb_branch, addr_t new_pc, Value *exit_code, BasicBlock *bb_ret);
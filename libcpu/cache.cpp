@@ -0,0 +1,205 @@
+/*
+ * libcpu: cache.cpp
+ *
+ * Translation cache shared by all cpus running the same code
+ * (CPU_CODEGEN_SHARE).
+ *
+ * Translated code gets the cpu_t, RAM and register files as
+ * arguments, so one translation can run for any cpu. Cpus whose code
+ * area has the same contents and that use the same settings share a
+ * cache entry: a private cpu_t that does all tagging and translation.
+ * The cpus themselves only keep copies of its function pointers.
+ */
+
+#include "libcpu.h"
+#include "cache.h"
+#include "coverage.h"
+#include "sha1.h"
+#include "tag.h"
+
+#if HAVE_PTHREAD_H
+#include <pthread.h>
+#define CACHE_LOCK(m)	pthread_mutex_lock(m)
+#define CACHE_UNLOCK(m)	pthread_mutex_unlock(m)
+#else
+#define CACHE_LOCK(m)
+#define CACHE_UNLOCK(m)
+#endif
+
+struct cache_entry {
+	std::string key;
+	cpu_t *translator;	/* owns tags, module and host code */
+	uint32_t users;
+#if HAVE_PTHREAD_H
+	pthread_mutex_t lock;
+#endif
+};
+
+typedef std::map<std::string, cache_entry *> cache_map;
+
+static cache_map entries;
+#if HAVE_PTHREAD_H
+static pthread_mutex_t entries_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* everything translated code depends on, apart from RAM and registers */
+static std::string
+cache_key(cpu_t *cpu)
+{
+	uint8_t digest[SHA_DIGEST_LENGTH];
+	SHA1_CTX ctx;
+
+	SHA1Init(&ctx);
+	SHA1Update(&ctx, &cpu->RAM[cpu->code_start], cpu->code_end - cpu->code_start);
+	/* translated code may contain constants from read-only memory */
+	for (range_map::iterator it = cpu->readonly.begin(); it != cpu->readonly.end(); it++) {
+		addr_t range[] = { it->first, it->second };
+		SHA1Update(&ctx, (uint8_t *)range, sizeof(range));
+		SHA1Update(&ctx, &cpu->RAM[it->first], it->second - it->first);
+	}
+	SHA1Final(digest, &ctx);
+	memcpy(cpu->code_digest, digest, sizeof(digest));
+
+	uint64_t settings[] = {
+		cpu->info.type,
+		cpu->info.common_flags,
+		cpu->info.arch_flags,
+		cpu->code_start,
+		cpu->code_end,
+		cpu->flags_codegen & ~CPU_CODEGEN_SHARE,
+		cpu->flags_debug,
+		cpu->flags_hint,
+		/* the callouts call these host functions */
+		(uintptr_t)cpu->trap_function,
+		cpu->trap_gpr_mask
+	};
+
+	std::string key((char const *)digest, sizeof(digest));
+	key.append((char const *)settings, sizeof(settings));
+
+	for (hook_map::const_iterator h = cpu->hooks.begin(); h != cpu->hooks.end(); h++) {
+		cpu_hook_abi_t const *abi = &h->second.abi;
+		uint64_t hook[] = {
+			h->first,
+			(uintptr_t)h->second.function,
+			abi->arg_count,
+			(uint64_t)abi->ret_reg,
+			abi->return_kind,
+			(uint64_t)abi->link_reg,
+			(uint64_t)abi->sp_reg,
+			abi->stack_base,
+			(uint64_t)abi->stack_offset,
+			abi->ret_size,
+			(uint64_t)abi->ret_adjust,
+			abi->sync_gpr_mask,
+			abi->can_trap
+		};
+		key.append((char const *)hook, sizeof(hook));
+		for (uint32_t i = 0; i < abi->arg_count; i++) {
+			uint64_t reg = (uint64_t)abi->arg_reg[i];
+			key.append((char const *)&reg, sizeof(reg));
+		}
+	}
+	return key;
+}
+
+static cache_entry *
+cache_attach(cpu_t *cpu)
+{
+	std::string key = cache_key(cpu);
+	cache_entry *e;
+
+	CACHE_LOCK(&entries_lock);
+	cache_map::iterator it = entries.find(key);
+	if (it != entries.end()) {
+		e = it->second;
+	} else {
+		e = new cache_entry;
+		e->key = key;
+		e->users = 0;
+#if HAVE_PTHREAD_H
+		pthread_mutex_init(&e->lock, NULL);
+#endif
+
+		cpu_t *t = cpu_new(cpu->info.type, cpu->info.common_flags,
+			cpu->info.arch_flags);
+		t->code_start = cpu->code_start;
+		t->code_end = cpu->code_end;
+		t->code_entry = cpu->code_entry;
+		t->flags_codegen = cpu->flags_codegen & ~CPU_CODEGEN_SHARE;
+		t->flags_debug = cpu->flags_debug;
+		t->flags_hint = cpu->flags_hint;
+		t->trap_function = cpu->trap_function;
+		t->trap_gpr_mask = cpu->trap_gpr_mask;
+		t->hooks = cpu->hooks;
+		t->readonly = cpu->readonly;
+		e->translator = t;
+
+		entries[key] = e;
+		LOG("INFO: new shared translation cache.\n");
+	}
+	e->users++;
+	CACHE_UNLOCK(&entries_lock);
+
+	cpu->shared = e;
+	return e;
+}
+
+void
+cache_tag(cpu_t *cpu, addr_t pc)
+{
+	cache_entry *e = cpu->shared;
+	if (e == NULL)
+		e = cache_attach(cpu);
+
+	CACHE_LOCK(&e->lock);
+	/* the code is the same in every user's RAM */
+	e->translator->RAM = cpu->RAM;
+	tag_start(e->translator, pc);
+	CACHE_UNLOCK(&e->lock);
+}
+
+void
+cache_translate(cpu_t *cpu)
+{
+	cache_entry *e = cpu->shared;
+	if (e == NULL)
+		e = cache_attach(cpu);
+
+	/* the map is read through the running cpu */
+	if ((cpu->flags_codegen & CPU_CODEGEN_COVERAGE) && cpu->coverage_map == NULL)
+		coverage_default_map(cpu);
+
+	CACHE_LOCK(&e->lock);
+	cpu_t *t = e->translator;
+	t->RAM = cpu->RAM;
+	cpu_translate(t);
+	for (uint32_t i = cpu->functions; i < t->functions; i++)
+		cpu->fp[i] = t->fp[i];
+	cpu->functions = t->functions;
+	CACHE_UNLOCK(&e->lock);
+}
+
+void
+cache_detach(cpu_t *cpu)
+{
+	cache_entry *e = cpu->shared;
+	bool last;
+
+	cpu->shared = NULL;
+	cpu->functions = 0;
+
+	CACHE_LOCK(&entries_lock);
+	last = --e->users == 0;
+	if (last)
+		entries.erase(e->key);
+	CACHE_UNLOCK(&entries_lock);
+
+	if (last) {
+		cpu_free(e->translator);
+#if HAVE_PTHREAD_H
+		pthread_mutex_destroy(&e->lock);
+#endif
+		delete e;
+	}
+}
@@ -0,0 +1,3 @@
+void cache_tag(cpu_t *cpu, addr_t pc);
+void cache_translate(cpu_t *cpu);
+void cache_detach(cpu_t *cpu);
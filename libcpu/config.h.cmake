@@ -1,5 +1,9 @@
 #cmakedefine HAVE_SYS_RESOURCE_H ${HAVE_SYS_RESOURCE_H}
 #cmakedefine HAVE_GETRUSAGE ${HAVE_GETRUSAGE}
+#cmakedefine HAVE_MMAP ${HAVE_MMAP}
+#cmakedefine HAVE_MPROTECT ${HAVE_MPROTECT}
+#cmakedefine HAVE_SIGACTION ${HAVE_SIGACTION}
+#cmakedefine HAVE_SHMAT ${HAVE_SHMAT}
 
 #cmakedefine HAVE_ATTRIBUTE_PACKED ${HAVE_ATTRIBUTE_PACKED}
 #cmakedefine HAVE_PRAGMA_PACK ${HAVE_PRAGMA_PACK}
@@ -8,5 +12,6 @@
 #cmakedefine HAVE_DECLSPEC_DLLEXPORT ${HAVE_DECLSPEC_DLLEXPORT}
 #cmakedefine HAVE_LIBREADLINE ${HAVE_LIBREADLINE}
 #cmakedefine HAVE_NETINET_IN_H ${HAVE_NETINET_IN_H}
+#cmakedefine HAVE_PTHREAD_H ${HAVE_PTHREAD_H}
 
 #cmakedefine HAVE_LIBRT ${HAVE_LIBRT}
@@ -0,0 +1,197 @@
+/*
+ * libcpu: coverage.cpp
+ *
+ * AFL style edge coverage (CPU_CODEGEN_COVERAGE). Every basic
+ * block has a pseudo random id; on entry, it increments
+ *     map[(prev ^ id) & (size - 1)]
+ * and sets prev = id >> 1. prev is kept in a local like the
+ * registers and saved in cpu->coverage_prev on return.
+ */
+
+#include "llvm/Constants.h"
+#include "llvm/Instructions.h"
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/Target/TargetData.h"
+
+#include "libcpu.h"
+#include "libcpu_llvm.h"
+#include "coverage.h"
+#include "function.h"
+#include "tag.h"
+
+#if HAVE_SHMAT
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#endif
+
+#define COVERAGE_DEFAULT_SIZE 65536
+#define COVERAGE_MIN_SIZE 64
+#define COVERAGE_MAX_SIZE (1 << 24)
+
+/*
+ * the map size from AFL_MAP_SIZE, rounded down to a power of two
+ * (never past the end of the map) and clamped to sane bounds
+ */
+static uint32_t
+coverage_env_size(cpu_t *cpu)
+{
+	char const *env = getenv("AFL_MAP_SIZE");
+	char *end;
+
+	if (env == NULL)
+		return COVERAGE_DEFAULT_SIZE;
+
+	unsigned long n = strtoul(env, &end, 10);
+	if (end == env || *end != '\0') {
+		LOG("INFO: ignoring AFL_MAP_SIZE=%s.\n", env);
+		return COVERAGE_DEFAULT_SIZE;
+	}
+	if (n < COVERAGE_MIN_SIZE)
+		n = COVERAGE_MIN_SIZE;
+	if (n > COVERAGE_MAX_SIZE)
+		n = COVERAGE_MAX_SIZE;
+
+	uint32_t size = COVERAGE_MIN_SIZE;
+	while (size * 2 <= n)
+		size *= 2;
+	return size;
+}
+
+/*
+ * if running under afl-fuzz, use its shared memory bitmap,
+ * otherwise allocate one
+ */
+void
+coverage_default_map(cpu_t *cpu)
+{
+	uint32_t size = coverage_env_size(cpu);
+
+#if HAVE_SHMAT
+	char const *id = getenv("__AFL_SHM_ID");
+	if (id != NULL) {
+		void *map = shmat(atoi(id), NULL, 0);
+		if (map != (void *)-1) {
+			LOG("INFO: using AFL coverage map %s.\n", id);
+			cpu_set_coverage_map(cpu, (uint8_t *)map, size);
+			return;
+		}
+	}
+#endif
+
+	cpu_set_coverage_map(cpu, NULL, size);
+}
+
+void
+coverage_done(cpu_t *cpu)
+{
+	if (cpu->coverage_alloc)
+		free(cpu->coverage_map);
+	cpu->coverage_map = NULL;
+	cpu->coverage_alloc = false;
+}
+
+/* load map, mask and prev into the entry block */
+void
+coverage_emit_decode(cpu_t *cpu, BasicBlock *bb)
+{
+	PointerType *type_pi8 = PointerType::getUnqual(getIntegerType(8));
+
+	if (cpu->coverage_map == NULL)
+		coverage_default_map(cpu);
+
+	cpu->ptr_coverage_map = new LoadInst(get_cpu_field_pointer(cpu,
+		&cpu->coverage_map, type_pi8, bb), "coverage_map", false, bb);
+
+	cpu->ptr_coverage_mask = BinaryOperator::Create(Instruction::Sub,
+		new LoadInst(get_cpu_field_pointer(cpu, &cpu->coverage_size,
+			getIntegerType(32), bb), "", false, bb),
+		ConstantInt::get(getIntegerType(32), 1), "coverage_mask", bb);
+
+	cpu->in_ptr_coverage_prev = get_cpu_field_pointer(cpu, &cpu->coverage_prev,
+		getIntegerType(32), bb);
+	cpu->ptr_coverage_prev = new AllocaInst(getIntegerType(32), "coverage_prev", bb);
+	new StoreInst(new LoadInst(cpu->in_ptr_coverage_prev, "", false, bb),
+		cpu->ptr_coverage_prev, false, bb);
+}
+
+void
+coverage_spill(cpu_t *cpu, BasicBlock *bb)
+{
+	new StoreInst(new LoadInst(cpu->ptr_coverage_prev, "", false, bb),
+		cpu->in_ptr_coverage_prev, false, bb);
+}
+
+void
+coverage_reload(cpu_t *cpu, BasicBlock *bb)
+{
+	new StoreInst(new LoadInst(cpu->in_ptr_coverage_prev, "", false, bb),
+		cpu->ptr_coverage_prev, false, bb);
+}
+
+/*
+ * A block that only starts because a conditional instruction
+ * before it was not taken has a single predecessor; its edge is
+ * implied by the edges that follow it.
+ */
+bool
+coverage_needed(cpu_t *cpu, addr_t pc)
+{
+	return (get_tag(cpu, pc) &
+		(TAG_BRANCH_TARGET | TAG_SUBROUTINE | TAG_AFTER_CALL |
+		 TAG_AFTER_TRAP | TAG_ENTRY)) != 0;
+}
+
+static uint32_t
+coverage_id(addr_t pc)
+{
+	return (uint32_t)(((uint64_t)pc * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+void
+emit_coverage(cpu_t *cpu, addr_t pc, BasicBlock *bb)
+{
+	Type const *intptr_type = cpu->exec_engine->getTargetData()->getIntPtrType(_CTX());
+	uint32_t id = coverage_id(pc);
+
+	Value *prev = new LoadInst(cpu->ptr_coverage_prev, "", false, bb);
+	Value *index = BinaryOperator::Create(Instruction::Xor, prev,
+		ConstantInt::get(getIntegerType(32), id), "", bb);
+	index = BinaryOperator::Create(Instruction::And, index, cpu->ptr_coverage_mask, "", bb);
+	index = new ZExtInst(index, intptr_type, "", bb);
+
+	Value *counter = GetElementPtrInst::Create(cpu->ptr_coverage_map, index, "", bb);
+	Value *v = new LoadInst(counter, "", false, bb);
+	v = BinaryOperator::Create(Instruction::Add, v, ConstantInt::get(getIntegerType(8), 1), "", bb);
+	new StoreInst(v, counter, false, bb);
+
+	new StoreInst(ConstantInt::get(getIntegerType(32), id >> 1), cpu->ptr_coverage_prev, false, bb);
+}
+
+//////////////////////////////////////////////////////////////////////
+// interface
+//////////////////////////////////////////////////////////////////////
+
+/*
+ * sets the coverage bitmap; size must be a power of two. If map
+ * is NULL, libcpu allocates it. The map and the previous location
+ * should be cleared between runs:
+ *     memset(cpu->coverage_map, 0, cpu->coverage_size);
+ *     cpu->coverage_prev = 0;
+ */
+void
+cpu_set_coverage_map(cpu_t *cpu, uint8_t *map, uint32_t size)
+{
+	assert(size != 0 && (size & (size - 1)) == 0 &&
+		"coverage map size must be a power of two");
+
+	coverage_done(cpu);
+	if (map == NULL) {
+		map = (uint8_t *)calloc(size, 1);
+		assert(map != NULL);
+		cpu->coverage_alloc = true;
+	}
+	cpu->coverage_map = map;
+	cpu->coverage_size = size;
+	cpu->coverage_prev = 0;
+}
@@ -0,0 +1,7 @@
+void coverage_default_map(cpu_t *cpu);
+void coverage_emit_decode(cpu_t *cpu, BasicBlock *bb);
+void coverage_spill(cpu_t *cpu, BasicBlock *bb);
+void coverage_reload(cpu_t *cpu, BasicBlock *bb);
+void coverage_done(cpu_t *cpu);
+bool coverage_needed(cpu_t *cpu, addr_t pc);
+void emit_coverage(cpu_t *cpu, addr_t pc, BasicBlock *bb);
@@ -7,6 +7,7 @@
  */
 
 #include <assert.h>
+#include <string.h>
 
 #include "llvm/Constants.h"
 #include "llvm/Intrinsics.h"
@@ -17,6 +18,7 @@
 #include "libcpu.h"
 #include "libcpu_llvm.h"
 #include "frontend.h"
+#include "function.h"
 
 //////////////////////////////////////////////////////////////////////
 // GENERIC: register access
@@ -186,9 +188,33 @@ arch_gep32(cpu_t *cpu, Value *a, BasicBlock *bb) {
 	return new BitCastInst(a, PointerType::get(XgetType(Int32Ty), 0), "", bb);
 }
 
+/* whether [a, a + size) is in memory declared read-only */
+bool
+arch_is_readonly(cpu_t *cpu, addr_t a, addr_t size) {
+	range_map::iterator it = cpu->readonly.upper_bound(a);
+	if (it == cpu->readonly.begin())
+		return false;
+	--it;
+	return a + size <= it->second;
+}
+
+/* the 32 bit value at a, as a load from translated code would see it */
+static uint32_t
+arch_fetch32(cpu_t *cpu, addr_t a) {
+	uint32_t v;
+	memcpy(&v, &cpu->RAM[a], sizeof(v));
+	if (cpu->flags & CPU_FLAG_SWAPMEM)
+		v = (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+	return v;
+}
+
 /* load 32 bit ALIGNED value from RAM */
 Value *
 arch_load32_aligned(cpu_t *cpu, Value *a, BasicBlock *bb) {
+	ConstantInt *c = dyn_cast<ConstantInt>(a);
+	if (c != NULL && arch_is_readonly(cpu, c->getZExtValue(), 4))
+		return CONST32(arch_fetch32(cpu, c->getZExtValue()));
+
 	a = arch_gep32(cpu, a, bb);
 	if (cpu->flags & CPU_FLAG_SWAPMEM)
 		return SWAP32(new LoadInst(a, "", false, bb));
@@ -227,6 +253,13 @@ arch_get_shift16(cpu_t *cpu, Value *addr, BasicBlock *bb)
 
 Value *
 arch_load8(cpu_t *cpu, Value *addr, BasicBlock *bb) {
+	ConstantInt *c = dyn_cast<ConstantInt>(addr);
+	if (c != NULL && arch_is_readonly(cpu, c->getZExtValue() & ~3ULL, 4)) {
+		addr_t a = c->getZExtValue();
+		unsigned shift = (IS_LITTLE_ENDIAN(cpu) ? a & 3 : ~a & 3) << 3;
+		return CONST8(arch_fetch32(cpu, a & ~3ULL) >> shift);
+	}
+
 	Value *shift = arch_get_shift8(cpu, addr, bb);
 	Value *val = arch_load32_aligned(cpu, AND(addr, CONST(~3ULL)), bb);
 	return TRUNC8(LSHR(val, shift));
@@ -234,6 +267,13 @@ arch_load8(cpu_t *cpu, Value *addr, BasicBlock *bb) {
 
 Value *
 arch_load16_aligned(cpu_t *cpu, Value *addr, BasicBlock *bb) {
+	ConstantInt *c = dyn_cast<ConstantInt>(addr);
+	if (c != NULL && arch_is_readonly(cpu, c->getZExtValue() & ~3ULL, 4)) {
+		addr_t a = c->getZExtValue();
+		unsigned shift = (IS_LITTLE_ENDIAN(cpu) ? a >> 1 & 1 : ~a >> 1 & 1) << 4;
+		return CONST16(arch_fetch32(cpu, a & ~3ULL) >> shift);
+	}
+
 	Value *shift = arch_get_shift16(cpu, addr, bb);
 	Value *val = arch_load32_aligned(cpu, AND(addr, CONST(~3ULL)), bb);
 	return TRUNC16(LSHR(val, shift));
@@ -259,6 +299,102 @@ arch_store16(cpu_t *cpu, Value *val, Value *addr, BasicBlock *bb) {
 	arch_store32_aligned(cpu, val, addr, bb);
 }
 
+//////////////////////////////////////////////////////////////////////
+// GENERIC: atomic memory access
+//////////////////////////////////////////////////////////////////////
+// Other cpus may run on the same RAM in other host threads. These
+// map to host atomic instructions, which are full barriers on x86;
+// elsewhere the guest's own barriers (arch_memory_barrier()) order
+// the surrounding accesses.
+
+static Value *
+arch_atomic_call(cpu_t *cpu, Intrinsic::ID id, Value *p, Value *v1, Value *v2, BasicBlock *bb)
+{
+	Type const *tys[2] = { v1->getType(), p->getType() };
+	Value *args[3] = { p, v1, v2 };
+	Function *f = Intrinsic::getDeclaration(cpu->mod, id, tys, 2);
+	return CallInst::Create(f, args, args + (v2 != NULL ? 3 : 2), "", bb);
+}
+
+/* the reservation of load linked/store conditional, as a 64 bit address */
+static Value *
+arch_link_addr(cpu_t *cpu, Value *a, BasicBlock *bb)
+{
+	return SIZE(a) < 64 ? ZEXT64(a) : a;
+}
+
+/* exchanges a byte in RAM, returns the old value */
+Value *
+arch_atomic_swap8(cpu_t *cpu, Value *v, Value *a, BasicBlock *bb) {
+	/* RAM is in guest byte order, so this is the guest's byte */
+	a = GetElementPtrInst::Create(cpu->ptr_RAM, a, "", bb);
+	return arch_atomic_call(cpu, Intrinsic::atomic_swap, a, TRUNC8(v), NULL, bb);
+}
+
+/* exchanges an ALIGNED 32 bit value in RAM, returns the old value */
+Value *
+arch_atomic_swap32(cpu_t *cpu, Value *v, Value *a, BasicBlock *bb) {
+	a = arch_gep32(cpu, a, bb);
+	if (cpu->flags & CPU_FLAG_SWAPMEM)
+		return SWAP32(arch_atomic_call(cpu, Intrinsic::atomic_swap, a, SWAP32(v), NULL, bb));
+	else
+		return arch_atomic_call(cpu, Intrinsic::atomic_swap, a, v, NULL, bb);
+}
+
+/* stores v if an ALIGNED 32 bit value in RAM is cmp, returns the old value */
+Value *
+arch_atomic_cmpxchg32(cpu_t *cpu, Value *cmp, Value *v, Value *a, BasicBlock *bb) {
+	a = arch_gep32(cpu, a, bb);
+	if (cpu->flags & CPU_FLAG_SWAPMEM)
+		return SWAP32(arch_atomic_call(cpu, Intrinsic::atomic_cmp_swap, a, SWAP32(cmp), SWAP32(v), bb));
+	else
+		return arch_atomic_call(cpu, Intrinsic::atomic_cmp_swap, a, cmp, v, bb);
+}
+
+/* loads an ALIGNED 32 bit value and reserves its address */
+Value *
+arch_load_linked32(cpu_t *cpu, Value *a, BasicBlock *bb) {
+	Value *v = new LoadInst(arch_gep32(cpu, a, bb), "", false, bb);
+	new StoreInst(arch_link_addr(cpu, a, bb), get_cpu_field_pointer(cpu,
+		&cpu->link_addr, getIntegerType(64), bb), bb);
+	new StoreInst(v, get_cpu_field_pointer(cpu, &cpu->link_value,
+		getIntegerType(32), bb), bb);
+	return (cpu->flags & CPU_FLAG_SWAPMEM) ? SWAP32(v) : v;
+}
+
+/*
+ * stores an ALIGNED 32 bit value if the address is reserved and
+ * still holds the value loaded by arch_load_linked32(), and drops
+ * the reservation. Returns whether the store was done.
+ * Like on most emulators, a store of the same value by another cpu
+ * in between goes unnoticed.
+ */
+Value *
+arch_store_conditional32(cpu_t *cpu, Value *v, Value *a, BasicBlock *bb) {
+	Value *link = get_cpu_field_pointer(cpu, &cpu->link_addr, getIntegerType(64), bb);
+	Value *linked = ICMP_EQ(arch_link_addr(cpu, a, bb), LOAD(link));
+	Value *expected = LOAD(get_cpu_field_pointer(cpu, &cpu->link_value,
+		getIntegerType(32), bb));
+
+	/* without reservation, the exchange goes to a scratch word */
+	Value *p = SELECT(linked, arch_gep32(cpu, a, bb), get_cpu_field_pointer(cpu,
+		&cpu->link_scratch, getIntegerType(32), bb));
+	if (cpu->flags & CPU_FLAG_SWAPMEM)
+		v = SWAP32(v);
+	Value *old = arch_atomic_call(cpu, Intrinsic::atomic_cmp_swap, p, expected, v, bb);
+
+	new StoreInst(CONST64(-1ULL), link, bb);
+	return AND(linked, ICMP_EQ(old, expected));
+}
+
+/* orders all loads and stores before against all after */
+void
+arch_memory_barrier(cpu_t *cpu, BasicBlock *bb) {
+	Value *args[5] = { TRUE, TRUE, TRUE, TRUE, FALSE };
+	Function *f = Intrinsic::getDeclaration(cpu->mod, Intrinsic::memory_barrier);
+	CallInst::Create(f, args, args + 5, "", bb);
+}
+
 //
 
 Value *
@@ -436,10 +572,22 @@ arch_debug_me(cpu_t *cpu, BasicBlock *bb)
 	if (cpu->ptr_func_debug == NULL)
 		return;
 
-	Type const *intptr_type = cpu->exec_engine->getTargetData()->getIntPtrType(_CTX());
-	Constant *v_cpu = ConstantInt::get(intptr_type, (uintptr_t)cpu);
-	Value *v_cpu_ptr = ConstantExpr::getIntToPtr(v_cpu, PointerType::getUnqual(intptr_type));
-
 	// XXX synchronize cpu context!
-	CallInst::Create(cpu->ptr_func_debug, v_cpu_ptr, "", bb);
+	CallInst::Create(cpu->ptr_func_debug, cpu->ptr_cpu, "", bb);
+}
+
+// Cycle counting
+
+/* add n (any integer type) to the guest cycles, if they are counted */
+void
+arch_add_cycles(cpu_t *cpu, Value *n, BasicBlock *bb)
+{
+	if (!(cpu->flags_codegen & CPU_CODEGEN_CYCLES) || cpu->ptr_cycles == NULL)
+		return;
+
+	if (n->getType() != getIntegerType(64))
+		n = new ZExtInst(n, getIntegerType(64), "", bb);
+	Value *cycles = new LoadInst(cpu->ptr_cycles, "", false, bb);
+	new StoreInst(BinaryOperator::Create(Instruction::Add, cycles, n, "", bb),
+		cpu->ptr_cycles, bb);
 }
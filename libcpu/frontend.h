@@ -3,12 +3,19 @@
 /* emitter functions */
 Value *arch_get_reg(cpu_t *cpu, uint32_t index, uint32_t bits, BasicBlock *bb);
 Value *arch_put_reg(cpu_t *cpu, uint32_t index, Value *v, uint32_t bits, bool sext, BasicBlock *bb);
+bool arch_is_readonly(cpu_t *cpu, addr_t a, addr_t size);
 Value *arch_load32_aligned(cpu_t *cpu, Value *a, BasicBlock *bb);
 void arch_store32_aligned(cpu_t *cpu, Value *v, Value *a, BasicBlock *bb);
 Value *arch_load8(cpu_t *cpu, Value *addr, BasicBlock *bb);
 Value *arch_load16_aligned(cpu_t *cpu, Value *addr, BasicBlock *bb);
 void arch_store8(cpu_t *cpu, Value *val, Value *addr, BasicBlock *bb);
 void arch_store16(cpu_t *cpu, Value *val, Value *addr, BasicBlock *bb);
+Value *arch_atomic_swap8(cpu_t *cpu, Value *v, Value *a, BasicBlock *bb);
+Value *arch_atomic_swap32(cpu_t *cpu, Value *v, Value *a, BasicBlock *bb);
+Value *arch_atomic_cmpxchg32(cpu_t *cpu, Value *cmp, Value *v, Value *a, BasicBlock *bb);
+Value *arch_load_linked32(cpu_t *cpu, Value *a, BasicBlock *bb);
+Value *arch_store_conditional32(cpu_t *cpu, Value *v, Value *a, BasicBlock *bb);
+void arch_memory_barrier(cpu_t *cpu, BasicBlock *bb);
 
 Value *arch_store(Value *v, Value *a, BasicBlock *bb);
 
@@ -41,6 +48,8 @@ Value *arch_sqrt(cpu_t *cpu, size_t width, Value *v, BasicBlock *bb);
 
 void arch_debug_me(cpu_t *cpu, BasicBlock *bb);
 
+void arch_add_cycles(cpu_t *cpu, Value *n, BasicBlock *bb);
+
 /* host functions */
 uint32_t RAM32BE(uint8_t *RAM, addr_t a);
 uint32_t RAM32LE(uint8_t *RAM, addr_t a);
@@ -191,6 +200,11 @@ uint32_t RAM32LE(uint8_t *RAM, addr_t a);
 #define STORE16(v,a) arch_store16(cpu,v, a, bb)
 #define STORE32(v,a) arch_store32_aligned(cpu,v, a, bb)
 
+#define XCHG8(v,a) arch_atomic_swap8(cpu, v, a, bb)
+#define XCHG32(v,a) arch_atomic_swap32(cpu, v, a, bb)
+#define LOAD_LINKED32(i,v) arch_put_reg(cpu, i, arch_load_linked32(cpu,v,bb), 32, true, bb)
+#define STORE_COND32(v,a) arch_store_conditional32(cpu, v, a, bb)
+
 /* byte swap */
 #define SWAP16(v) arch_bswap(cpu, 16, v, bb)
 #define SWAP32(v) arch_bswap(cpu, 32, v, bb)
@@ -264,6 +278,9 @@ uint32_t RAM32LE(uint8_t *RAM, addr_t a);
 /* float intrsinics */
 #define FPSQRT(v)    arch_sqrt(cpu, 64, v, bb)
 
+/* variable instruction timing, see CPU_CODEGEN_CYCLES */
+#define CYCLES(n)    arch_add_cycles(cpu, n, bb)
+
 /* debugging */
 #define DEBUG_ME()   arch_debug_me(cpu, bb)
 
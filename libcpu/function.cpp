@@ -5,6 +5,7 @@
  * basic blocks
  */
 
+#include <algorithm>
 #include <vector>
 
 #include "llvm/CallingConv.h"
@@ -17,11 +18,30 @@
 #include "libcpu.h"
 #include "libcpu_llvm.h"
 #include "frontend.h" // XXX for arch_flags_encode() / arch_flags_decode()
+#include "coverage.h"
 
 //////////////////////////////////////////////////////////////////////
 // function
 //////////////////////////////////////////////////////////////////////
 
+/*
+ * Pointer to a field of the cpu_t the generated code runs for.
+ * The cpu_t is an argument of the generated function, so the
+ * code does not depend on the cpu_t it was generated with.
+ */
+Value *
+get_cpu_field_pointer(cpu_t *cpu, void const *field, Type const *type, BasicBlock *bb)
+{
+	size_t offset = (uint8_t const *)field - (uint8_t const *)cpu;
+	assert(offset < sizeof(cpu_t));
+
+	Value *cpu8 = new BitCastInst(cpu->ptr_cpu,
+		PointerType::getUnqual(getIntegerType(8)), "", bb);
+	Value *p = GetElementPtrInst::Create(cpu8,
+		ConstantInt::get(getIntegerType(32), offset), "", bb);
+	return new BitCastInst(p, PointerType::getUnqual(type), "", bb);
+}
+
 static StructType *
 get_struct_reg(cpu_t *cpu) {
 	std::vector<const Type*>type_struct_reg_t_fields;
@@ -175,11 +195,39 @@ emit_decode_reg(cpu_t *cpu, BasicBlock *bb)
 		cpu->info.register_size[CPU_REG_FPR], cpu->in_ptr_fpr,
 		cpu->ptr_fpr, bb);
 
-	// PC pointer.
-	Type const *intptr_type = cpu->exec_engine->getTargetData()->getIntPtrType(_CTX());
-	Constant *v_pc = ConstantInt::get(intptr_type, (uintptr_t)cpu->rf.pc);
-	cpu->ptr_PC = ConstantExpr::getIntToPtr(v_pc, PointerType::getUnqual(getIntegerType(cpu->info.address_size)));
-	cpu->ptr_PC->setName("pc");
+	// PC pointer, it lives in the register file.
+	size_t pc_offset = (uint8_t *)cpu->rf.pc - (uint8_t *)cpu->rf.grf;
+	assert(pc_offset < cpu->rf.grf_size && "the PC is not in the register file");
+	Value *grf8 = new BitCastInst(cpu->ptr_grf,
+		PointerType::getUnqual(getIntegerType(8)), "", bb);
+	cpu->ptr_PC = new BitCastInst(GetElementPtrInst::Create(grf8,
+			ConstantInt::get(getIntegerType(32), pc_offset), "", bb),
+		PointerType::getUnqual(getIntegerType(cpu->info.address_size)), "pc", bb);
+
+	// budget
+	if (cpu->flags_codegen & CPU_CODEGEN_BUDGET) {
+		cpu->in_ptr_budget = get_cpu_field_pointer(cpu, &cpu->budget, getIntegerType(64), bb);
+		cpu->ptr_budget = new AllocaInst(getIntegerType(64), "budget", bb);
+		new StoreInst(new LoadInst(cpu->in_ptr_budget, "", false, bb), cpu->ptr_budget, false, bb);
+	}
+
+	// cycles
+	if (cpu->flags_codegen & CPU_CODEGEN_CYCLES) {
+		cpu->in_ptr_cycles = get_cpu_field_pointer(cpu, &cpu->cycles, getIntegerType(64), bb);
+		cpu->ptr_cycles = new AllocaInst(getIntegerType(64), "cycles", bb);
+		new StoreInst(new LoadInst(cpu->in_ptr_cycles, "", false, bb), cpu->ptr_cycles, false, bb);
+	} else
+		cpu->ptr_cycles = NULL;
+
+	// pending interrupts; never cached, see emit_block_entry()
+	if (cpu->flags_codegen & CPU_CODEGEN_INTERRUPTS) {
+		cpu->ptr_interrupt_pending = get_cpu_field_pointer(cpu,
+			(void const *)&cpu->interrupt_pending, getIntegerType(32), bb);
+	}
+
+	// coverage
+	if (cpu->flags_codegen & CPU_CODEGEN_COVERAGE)
+		coverage_emit_decode(cpu, bb);
 
 	// flags
 	if (cpu->info.psr_size != 0) {
@@ -216,18 +264,38 @@ emit_decode_reg(cpu_t *cpu, BasicBlock *bb)
 		cpu->f.emit_decode_reg(cpu, bb);
 }
 
+#define REG_MASK_ALL (~(uint64_t)0)
+/* registers above 63 are not covered by a mask and always synced */
+#define REG_IN_MASK(mask, i) ((i) >= 64 || ((mask) >> (i)) & 1)
+
 static void
-spill_reg_state_helper(uint32_t count, Value **in_ptr_r, Value **ptr_r,
-	BasicBlock *bb)
+spill_reg_state_helper(uint32_t count, uint64_t mask, Value **in_ptr_r,
+	Value **ptr_r, BasicBlock *bb)
 {
 #ifdef OPT_LOCAL_REGISTERS
 	for (uint32_t i = 0; i < count; i++) {
+		if (!REG_IN_MASK(mask, i))
+			continue;
 		LoadInst* v = new LoadInst(ptr_r[i], "", false, bb);
 		new StoreInst(v, in_ptr_r[i], false, bb);
 	}
 #endif
 }
 
+static void
+reload_reg_state_helper(uint32_t count, uint64_t mask, Value **in_ptr_r,
+	Value **ptr_r, BasicBlock *bb)
+{
+#ifdef OPT_LOCAL_REGISTERS
+	for (uint32_t i = 0; i < count; i++) {
+		if (!REG_IN_MASK(mask, i))
+			continue;
+		LoadInst* v = new LoadInst(in_ptr_r[i], "", false, bb);
+		new StoreInst(v, ptr_r[i], false, bb);
+	}
+#endif
+}
+
 static void
 spill_fp_reg_state_helper(cpu_t *cpu, uint32_t count, uint32_t width,
 	Value **in_ptr_r, Value **ptr_r, BasicBlock *bb)
@@ -251,12 +319,47 @@ spill_fp_reg_state_helper(cpu_t *cpu, uint32_t count, uint32_t width,
 }
 
 static void
+reload_fp_reg_state_helper(cpu_t *cpu, uint32_t count, uint32_t width,
+	Value **in_ptr_r, Value **ptr_r, BasicBlock *bb)
+{
+#ifdef OPT_LOCAL_REGISTERS
+	for (uint32_t i = 0; i < count; i++) {
+		if ((width == 80 && (cpu->flags & CPU_FLAG_FP80) == 0) ||
+			(width == 128 && (cpu->flags & CPU_FLAG_FP128) == 0)) {
+			LoadInst* v = new LoadInst(in_ptr_r[i*2+0], "", false, 0, bb);
+			new StoreInst(v, ptr_r[i*2+0], false, 0, bb);
+
+			v = new LoadInst(in_ptr_r[i*2+1], "", false, 0, bb);
+			new StoreInst(v, ptr_r[i*2+1], false, 0, bb);
+		} else {
+			LoadInst* v = new LoadInst(in_ptr_r[i], "", false,
+				fp_alignment(width), bb);
+			new StoreInst(v, ptr_r[i], false, fp_alignment(width), bb);
+		}
+	}
+#endif
+}
+
+/* write back the whole guest state, when leaving the function */
+void
 spill_reg_state(cpu_t *cpu, BasicBlock *bb)
 {
 	// frontend specific part.
 	if (cpu->f.spill_reg_state != NULL)
 		cpu->f.spill_reg_state(cpu, bb);
 
+	// budget
+	if (cpu->flags_codegen & CPU_CODEGEN_BUDGET)
+		new StoreInst(new LoadInst(cpu->ptr_budget, "", false, bb), cpu->in_ptr_budget, false, bb);
+
+	// cycles
+	if (cpu->flags_codegen & CPU_CODEGEN_CYCLES)
+		new StoreInst(new LoadInst(cpu->ptr_cycles, "", false, bb), cpu->in_ptr_cycles, false, bb);
+
+	// coverage
+	if (cpu->flags_codegen & CPU_CODEGEN_COVERAGE)
+		coverage_spill(cpu, bb);
+
 	// flags
 	if (cpu->info.psr_size != 0) {
 		Value *flags = arch_flags_encode(cpu, bb);
@@ -265,11 +368,11 @@ spill_reg_state(cpu_t *cpu, BasicBlock *bb)
 
 	// GPRs
 	spill_reg_state_helper(cpu->info.register_count[CPU_REG_GPR],
-		cpu->in_ptr_gpr, cpu->ptr_gpr, bb);
+		REG_MASK_ALL, cpu->in_ptr_gpr, cpu->ptr_gpr, bb);
 
 	// XRs
 	spill_reg_state_helper(cpu->info.register_count[CPU_REG_XR],
-		cpu->in_ptr_xr, cpu->ptr_xr, bb);
+		REG_MASK_ALL, cpu->in_ptr_xr, cpu->ptr_xr, bb);
 
 	// FPRs
 	spill_fp_reg_state_helper(cpu, cpu->info.register_count[CPU_REG_FPR],
@@ -277,11 +380,113 @@ spill_reg_state(cpu_t *cpu, BasicBlock *bb)
 		cpu->ptr_fpr, bb);
 }
 
+/*
+ * the reverse of spill_reg_state(), after a call of another
+ * translated function, which may have changed any of it
+ */
+void
+reload_reg_state(cpu_t *cpu, BasicBlock *bb)
+{
+	// GPRs
+	reload_reg_state_helper(cpu->info.register_count[CPU_REG_GPR],
+		REG_MASK_ALL, cpu->in_ptr_gpr, cpu->ptr_gpr, bb);
+
+	// XRs
+	reload_reg_state_helper(cpu->info.register_count[CPU_REG_XR],
+		REG_MASK_ALL, cpu->in_ptr_xr, cpu->ptr_xr, bb);
+
+	// FPRs
+	reload_fp_reg_state_helper(cpu, cpu->info.register_count[CPU_REG_FPR],
+		cpu->info.register_size[CPU_REG_FPR], cpu->in_ptr_fpr,
+		cpu->ptr_fpr, bb);
+
+	// flags
+	if (cpu->info.psr_size != 0) {
+		Value *flags = new LoadInst(cpu->ptr_xr[0], "", false, bb);
+		arch_flags_decode(cpu, flags, bb);
+	}
+
+	// budget
+	if (cpu->flags_codegen & CPU_CODEGEN_BUDGET)
+		new StoreInst(new LoadInst(cpu->in_ptr_budget, "", false, bb), cpu->ptr_budget, false, bb);
+
+	// cycles
+	if (cpu->flags_codegen & CPU_CODEGEN_CYCLES)
+		new StoreInst(new LoadInst(cpu->in_ptr_cycles, "", false, bb), cpu->ptr_cycles, false, bb);
+
+	// coverage
+	if (cpu->flags_codegen & CPU_CODEGEN_COVERAGE)
+		coverage_reload(cpu, bb);
+
+	// frontend specific part.
+	if (cpu->f.reload_reg_state != NULL)
+		cpu->f.reload_reg_state(cpu, bb);
+}
+
+/*
+ * write back the state a host callout may look at: the flags, the
+ * XRs, the GPRs in gpr_mask and the cycles. FPRs, the budget and the
+ * coverage state stay in the local variables.
+ */
+void
+spill_callout_state(cpu_t *cpu, uint64_t gpr_mask, BasicBlock *bb)
+{
+	// frontend specific part.
+	if (cpu->f.spill_reg_state != NULL)
+		cpu->f.spill_reg_state(cpu, bb);
+
+	// flags
+	if (cpu->info.psr_size != 0) {
+		Value *flags = arch_flags_encode(cpu, bb);
+		new StoreInst(flags, cpu->ptr_xr[0], false, bb);
+	}
+
+	// GPRs
+	spill_reg_state_helper(cpu->info.register_count[CPU_REG_GPR],
+		gpr_mask, cpu->in_ptr_gpr, cpu->ptr_gpr, bb);
+
+	// XRs
+	spill_reg_state_helper(cpu->info.register_count[CPU_REG_XR],
+		REG_MASK_ALL, cpu->in_ptr_xr, cpu->ptr_xr, bb);
+
+	// cycles, for device timing
+	if (cpu->flags_codegen & CPU_CODEGEN_CYCLES)
+		new StoreInst(new LoadInst(cpu->ptr_cycles, "", false, bb), cpu->in_ptr_cycles, false, bb);
+}
+
+/* the reverse of spill_callout_state(), after the callout returned */
+void
+reload_callout_state(cpu_t *cpu, uint64_t gpr_mask, BasicBlock *bb)
+{
+	// GPRs
+	reload_reg_state_helper(cpu->info.register_count[CPU_REG_GPR],
+		gpr_mask, cpu->in_ptr_gpr, cpu->ptr_gpr, bb);
+
+	// XRs
+	reload_reg_state_helper(cpu->info.register_count[CPU_REG_XR],
+		REG_MASK_ALL, cpu->in_ptr_xr, cpu->ptr_xr, bb);
+
+	// flags
+	if (cpu->info.psr_size != 0) {
+		Value *flags = new LoadInst(cpu->ptr_xr[0], "", false, bb);
+		arch_flags_decode(cpu, flags, bb);
+	}
+
+	// cycles
+	if (cpu->flags_codegen & CPU_CODEGEN_CYCLES)
+		new StoreInst(new LoadInst(cpu->in_ptr_cycles, "", false, bb), cpu->ptr_cycles, false, bb);
+
+	// frontend specific part.
+	if (cpu->f.reload_reg_state != NULL)
+		cpu->f.reload_reg_state(cpu, bb);
+}
+
+/*
+ * declare a function with the signature of jitmain(); its body is
+ * created by cpu_define_function()
+ */
 Function*
-cpu_create_function(cpu_t *cpu, const char *name,
-	BasicBlock **p_bb_ret,
-	BasicBlock **p_bb_trap,
-	BasicBlock **p_label_entry)
+cpu_declare_function(cpu_t *cpu, const char *name)
 {
 	Function *func;
 
@@ -309,12 +514,13 @@ cpu_create_function(cpu_t *cpu, const char *name,
 		false);		      	/* isVarArg */
 	cpu->type_pfunc_callout = PointerType::get(type_func_callout, 0);
 
-	// - (*f)(uint8_t *, reg_t *, fp_reg_t *, (*)(...)) [jitmain() function pointer)
+	// - (*f)(uint8_t *, reg_t *, fp_reg_t *, (*)(...), cpu_t *) [jitmain() function pointer)
 	std::vector<const Type*>type_func_args;
 	type_func_args.push_back(type_pi8);				/* uint8_t *RAM */
 	type_func_args.push_back(type_pstruct_reg_t);	/* reg_t *reg */
 	type_func_args.push_back(type_pstruct_fp_reg_t);	/* fp_reg_t *fp_reg */
 	type_func_args.push_back(cpu->type_pfunc_callout);	/* (*debug)(...) */
+	type_func_args.push_back(type_intptr);	/* intptr *cpu */
 	FunctionType* type_func = FunctionType::get(
 		getIntegerType(32),		/* Result */
 		type_func_args,		/* Params */
@@ -330,14 +536,31 @@ cpu_create_function(cpu_t *cpu, const char *name,
 	{
 		SmallVector<AttributeWithIndex, 4> Attrs;
 		AttributeWithIndex PAWI;
-		PAWI.Index = 1U; PAWI.Attrs = 0  | Attribute::NoCapture;
+		/* RAM, GPRs and FPRs are separate allocations */
+		PAWI.Index = 1U; PAWI.Attrs = 0  | Attribute::NoAlias;
+		Attrs.push_back(PAWI);
+		PAWI.Index = 2U; PAWI.Attrs = 0  | Attribute::NoAlias;
+		Attrs.push_back(PAWI);
+		PAWI.Index = 3U; PAWI.Attrs = 0  | Attribute::NoAlias;
 		Attrs.push_back(PAWI);
 		PAWI.Index = 4294967295U; PAWI.Attrs = 0  | Attribute::NoUnwind;
 		Attrs.push_back(PAWI);
 		func_PAL = AttrListPtr::get(Attrs.begin(), Attrs.end());
 	}
 	func->setAttributes(func_PAL);
+	return func;
+}
 
+/*
+ * create the entry, ret and trap blocks of a function declared by
+ * cpu_declare_function(), and point the cpu->ptr_* values into it
+ */
+void
+cpu_define_function(cpu_t *cpu, Function *func,
+	BasicBlock **p_bb_ret,
+	BasicBlock **p_bb_trap,
+	BasicBlock **p_label_entry)
+{
 	// args
 	Function::arg_iterator args = func->arg_begin();
 	cpu->ptr_RAM = args++;
@@ -348,13 +571,31 @@ cpu_create_function(cpu_t *cpu, const char *name,
 	cpu->ptr_frf->setName("frf");
 	cpu->ptr_func_debug = args++;
 	cpu->ptr_func_debug->setName("debug");
+	cpu->ptr_cpu = args++;
+	cpu->ptr_cpu->setName("cpu");
 
 	// entry basicblock
 	BasicBlock *label_entry = BasicBlock::Create(_CTX(), "entry", func, 0);
+
+	/*
+	 * Hooks and trap functions reach RAM and the register files
+	 * through the cpu_t. Storing the (unchanged) pointers there lets
+	 * them escape, so LLVM doesn't move accesses across these calls
+	 * although the arguments are noalias.
+	 */
+	PointerType *type_pi8 = PointerType::get(getIntegerType(8), 0);
+	new StoreInst(cpu->ptr_RAM, get_cpu_field_pointer(cpu, &cpu->RAM,
+		type_pi8, label_entry), label_entry);
+	new StoreInst(new BitCastInst(cpu->ptr_grf, type_pi8, "", label_entry),
+		get_cpu_field_pointer(cpu, &cpu->rf.grf, type_pi8, label_entry), label_entry);
+	new StoreInst(new BitCastInst(cpu->ptr_frf, type_pi8, "", label_entry),
+		get_cpu_field_pointer(cpu, &cpu->rf.frf, type_pi8, label_entry), label_entry);
+
 	emit_decode_reg(cpu, label_entry);
 
 	// create exit code
 	Value *exit_code = new AllocaInst(getIntegerType(32), "exit_code", label_entry);
+	cpu->ptr_exit_code = exit_code;
 	// assume JIT_RETURN_FUNCNOTFOUND or JIT_RETURN_SINGLESTEP if in in single step.
 	new StoreInst(ConstantInt::get(XgetType(Int32Ty),
 					(cpu->flags_debug & (CPU_DEBUG_SINGLESTEP | CPU_DEBUG_SINGLESTEP_BB)) ? JIT_RETURN_SINGLESTEP :
@@ -379,5 +620,91 @@ cpu_create_function(cpu_t *cpu, const char *name,
 	*p_bb_ret = bb_ret;
 	*p_bb_trap = bb_trap;
 	*p_label_entry = label_entry;
+}
+
+/*
+ * The ptr_* values point into the function being translated, so they
+ * are saved while another function is translated in between (see
+ * translate_subroutine()). Of the frontend state only the feptr
+ * pointer itself is saved.
+ */
+#define SAVE_ARRAY(v, a, n) (v).assign((a), (a) + ((a) != NULL ? (n) : 0))
+#define RESTORE_ARRAY(v, a) std::copy((v).begin(), (v).end(), (a))
+
+void
+save_function_state(cpu_t *cpu, function_state_t *state)
+{
+	state->ptr_PC = cpu->ptr_PC;
+	state->ptr_RAM = cpu->ptr_RAM;
+	state->ptr_grf = cpu->ptr_grf;
+	state->ptr_frf = cpu->ptr_frf;
+	state->ptr_func_debug = cpu->ptr_func_debug;
+	state->ptr_cpu = cpu->ptr_cpu;
+	state->ptr_exit_code = cpu->ptr_exit_code;
+	state->ptr_budget = cpu->ptr_budget;
+	state->in_ptr_budget = cpu->in_ptr_budget;
+	state->ptr_cycles = cpu->ptr_cycles;
+	state->in_ptr_cycles = cpu->in_ptr_cycles;
+	state->ptr_interrupt_pending = cpu->ptr_interrupt_pending;
+	state->ptr_coverage_map = cpu->ptr_coverage_map;
+	state->ptr_coverage_mask = cpu->ptr_coverage_mask;
+	state->ptr_coverage_prev = cpu->ptr_coverage_prev;
+	state->in_ptr_coverage_prev = cpu->in_ptr_coverage_prev;
+	state->ptr_N = cpu->ptr_N;
+	state->ptr_V = cpu->ptr_V;
+	state->ptr_Z = cpu->ptr_Z;
+	state->ptr_C = cpu->ptr_C;
+	SAVE_ARRAY(state->gpr, cpu->ptr_gpr, cpu->info.register_count[CPU_REG_GPR]);
+	SAVE_ARRAY(state->in_gpr, cpu->in_ptr_gpr, cpu->info.register_count[CPU_REG_GPR]);
+	SAVE_ARRAY(state->xr, cpu->ptr_xr, cpu->info.register_count[CPU_REG_XR]);
+	SAVE_ARRAY(state->in_xr, cpu->in_ptr_xr, cpu->info.register_count[CPU_REG_XR]);
+	SAVE_ARRAY(state->fpr, cpu->ptr_fpr, cpu->info.register_count[CPU_REG_FPR]);
+	SAVE_ARRAY(state->in_fpr, cpu->in_ptr_fpr, cpu->info.register_count[CPU_REG_FPR]);
+	SAVE_ARRAY(state->flag, cpu->ptr_FLAG, cpu->info.flags_count);
+	state->feptr = cpu->feptr;
+}
+
+void
+restore_function_state(cpu_t *cpu, function_state_t const *state)
+{
+	cpu->ptr_PC = state->ptr_PC;
+	cpu->ptr_RAM = state->ptr_RAM;
+	cpu->ptr_grf = state->ptr_grf;
+	cpu->ptr_frf = state->ptr_frf;
+	cpu->ptr_func_debug = state->ptr_func_debug;
+	cpu->ptr_cpu = state->ptr_cpu;
+	cpu->ptr_exit_code = state->ptr_exit_code;
+	cpu->ptr_budget = state->ptr_budget;
+	cpu->in_ptr_budget = state->in_ptr_budget;
+	cpu->ptr_cycles = state->ptr_cycles;
+	cpu->in_ptr_cycles = state->in_ptr_cycles;
+	cpu->ptr_interrupt_pending = state->ptr_interrupt_pending;
+	cpu->ptr_coverage_map = state->ptr_coverage_map;
+	cpu->ptr_coverage_mask = state->ptr_coverage_mask;
+	cpu->ptr_coverage_prev = state->ptr_coverage_prev;
+	cpu->in_ptr_coverage_prev = state->in_ptr_coverage_prev;
+	cpu->ptr_N = state->ptr_N;
+	cpu->ptr_V = state->ptr_V;
+	cpu->ptr_Z = state->ptr_Z;
+	cpu->ptr_C = state->ptr_C;
+	RESTORE_ARRAY(state->gpr, cpu->ptr_gpr);
+	RESTORE_ARRAY(state->in_gpr, cpu->in_ptr_gpr);
+	RESTORE_ARRAY(state->xr, cpu->ptr_xr);
+	RESTORE_ARRAY(state->in_xr, cpu->in_ptr_xr);
+	RESTORE_ARRAY(state->fpr, cpu->ptr_fpr);
+	RESTORE_ARRAY(state->in_fpr, cpu->in_ptr_fpr);
+	RESTORE_ARRAY(state->flag, cpu->ptr_FLAG);
+	cpu->feptr = state->feptr;
+}
+
+Function*
+cpu_create_function(cpu_t *cpu, const char *name,
+	BasicBlock **p_bb_ret,
+	BasicBlock **p_bb_trap,
+	BasicBlock **p_label_entry)
+{
+	Function *func = cpu_declare_function(cpu, name);
+
+	cpu_define_function(cpu, func, p_bb_ret, p_bb_trap, p_label_entry);
 	return func;
 }
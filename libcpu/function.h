@@ -1 +1,22 @@
 Function *cpu_create_function(cpu_t *cpu, const char *name, BasicBlock **p_bb_ret, BasicBlock **p_bb_trap, BasicBlock **p_label_entry);
+Function *cpu_declare_function(cpu_t *cpu, const char *name);
+void cpu_define_function(cpu_t *cpu, Function *func, BasicBlock **p_bb_ret, BasicBlock **p_bb_trap, BasicBlock **p_label_entry);
+Value *get_cpu_field_pointer(cpu_t *cpu, void const *field, Type const *type, BasicBlock *bb);
+void spill_reg_state(cpu_t *cpu, BasicBlock *bb);
+void reload_reg_state(cpu_t *cpu, BasicBlock *bb);
+void spill_callout_state(cpu_t *cpu, uint64_t gpr_mask, BasicBlock *bb);
+void reload_callout_state(cpu_t *cpu, uint64_t gpr_mask, BasicBlock *bb);
+
+/* the cpu->ptr_* values of a function, see cpu_define_function() */
+typedef struct {
+	Value *ptr_PC, *ptr_RAM, *ptr_grf, *ptr_frf, *ptr_func_debug, *ptr_cpu, *ptr_exit_code;
+	Value *ptr_budget, *in_ptr_budget, *ptr_cycles, *in_ptr_cycles;
+	Value *ptr_interrupt_pending;
+	Value *ptr_coverage_map, *ptr_coverage_mask, *ptr_coverage_prev, *in_ptr_coverage_prev;
+	Value *ptr_N, *ptr_V, *ptr_Z, *ptr_C;
+	std::vector<Value *> gpr, in_gpr, xr, in_xr, fpr, in_fpr, flag;
+	void *feptr;
+} function_state_t;
+
+void save_function_state(cpu_t *cpu, function_state_t *state);
+void restore_function_state(cpu_t *cpu, function_state_t const *state);
@@ -0,0 +1,183 @@
+/*
+ * libcpu: hook.cpp
+ *
+ * High level emulation hooks (cpu_hook()). The basic block of a
+ * hooked guest address does not contain the guest code, but calls
+ * the host function with the arguments taken from the guest
+ * registers, stores the result, and returns to the guest caller:
+ *
+ *     PC = addr
+ *     [spill flags, XRs and sync_gpr_mask]
+ *     r = f(cpu, args...)
+ *     [reload them]
+ *     [if r == CPU_HOOK_TRAP, goto trap (abi.can_trap only)]
+ *     ret_reg = r
+ *     PC = return address + ret_adjust
+ *     goto dispatch
+ *
+ * The tagger does not descend into hooked addresses, so the guest
+ * code there does not have to exist.
+ */
+
+#include <vector>
+
+#include "llvm/Constants.h"
+#include "llvm/DerivedTypes.h"
+#include "llvm/Instructions.h"
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/Target/TargetData.h"
+
+#include "libcpu.h"
+#include "libcpu_llvm.h"
+#include "frontend.h"
+#include "function.h"
+#include "hook.h"
+
+bool
+is_hooked(cpu_t *cpu, addr_t addr)
+{
+	return !cpu->hooks.empty() && cpu->hooks.find(addr) != cpu->hooks.end();
+}
+
+/* zero extend or truncate */
+static Value *
+hook_cast(Value *v, uint32_t bits, BasicBlock *bb)
+{
+	return CastInst::CreateIntegerCast(v, getIntegerType(bits), false, "", bb);
+}
+
+static Value *
+hook_get_gpr(cpu_t *cpu, int reg, BasicBlock *bb)
+{
+	assert(reg >= 0 && (uint32_t)reg < cpu->info.register_count[CPU_REG_GPR]);
+	return new LoadInst(cpu->ptr_gpr[reg], "", false, bb);
+}
+
+static void
+hook_put_gpr(cpu_t *cpu, int reg, Value *v, BasicBlock *bb)
+{
+	assert(reg >= 0 && (uint32_t)reg < cpu->info.register_count[CPU_REG_GPR]);
+	v = hook_cast(v, cpu->info.register_size[CPU_REG_GPR], bb);
+	new StoreInst(v, cpu->ptr_gpr[reg], false, bb);
+}
+
+/* pop the return address, in guest byte order */
+static Value *
+hook_pop(cpu_t *cpu, cpu_hook_abi_t const *abi, BasicBlock *bb)
+{
+	uint32_t reg_size = cpu->info.register_size[CPU_REG_GPR];
+	bool big_endian = (cpu->info.common_flags & CPU_FLAG_ENDIAN_MASK) == CPU_FLAG_ENDIAN_BIG;
+	Value *sp = hook_get_gpr(cpu, abi->sp_reg, bb);
+
+	// sp + offset wraps like the stack pointer does
+	Value *a = BinaryOperator::Create(Instruction::Add, sp,
+		ConstantInt::get(getIntegerType(reg_size), abi->stack_offset), "", bb);
+	a = BinaryOperator::Create(Instruction::Add, hook_cast(a, 64, bb),
+		ConstantInt::get(getIntegerType(64), abi->stack_base), "", bb);
+
+	Value *v = ConstantInt::get(getIntegerType(64), 0);
+	for (uint32_t i = 0; i < abi->ret_size; i++) {
+		Value *ai = BinaryOperator::Create(Instruction::Add, a,
+			ConstantInt::get(getIntegerType(64), i), "", bb);
+		Value *b = new LoadInst(GetElementPtrInst::Create(cpu->ptr_RAM, ai, "", bb), "", false, bb);
+		uint32_t shift = 8 * (big_endian ? abi->ret_size - 1 - i : i);
+		b = BinaryOperator::Create(Instruction::Shl, hook_cast(b, 64, bb),
+			ConstantInt::get(getIntegerType(64), shift), "", bb);
+		v = BinaryOperator::Create(Instruction::Or, v, b, "", bb);
+	}
+
+	hook_put_gpr(cpu, abi->sp_reg, BinaryOperator::Create(Instruction::Add, sp,
+		ConstantInt::get(getIntegerType(reg_size), abi->ret_size), "", bb), bb);
+	return v;
+}
+
+void
+emit_hook(cpu_t *cpu, addr_t addr, BasicBlock *bb, BasicBlock *bb_dispatch,
+	BasicBlock *bb_trap)
+{
+	cpu_hook_t const *hook = &cpu->hooks[addr];
+	cpu_hook_abi_t const *abi = &hook->abi;
+	uint32_t address_size = cpu->info.address_size;
+	Type const *intptr_type = cpu->exec_engine->getTargetData()->getIntPtrType(_CTX());
+	PointerType *type_pintptr = PointerType::getUnqual(intptr_type);
+
+	LOG("hook: $%08llx\n", (unsigned long long)addr);
+
+	// the function sees where it was called
+	new StoreInst(ConstantInt::get(getIntegerType(address_size), addr), cpu->ptr_PC, bb);
+
+	if (abi->sync_gpr_mask != 0)
+		spill_callout_state(cpu, abi->sync_gpr_mask, bb);
+
+	// uint64_t (*)(cpu_t *, uint64_t, ...)
+	std::vector<const Type*> type_func_args;
+	std::vector<Value*> args;
+	type_func_args.push_back(type_pintptr);
+	args.push_back(cpu->ptr_cpu);
+	for (uint32_t i = 0; i < abi->arg_count; i++) {
+		type_func_args.push_back(getIntegerType(64));
+		args.push_back(hook_cast(hook_get_gpr(cpu, abi->arg_reg[i], bb), 64, bb));
+	}
+	FunctionType *type_func = FunctionType::get(getIntegerType(64),
+		type_func_args, false);
+
+	Constant *v_func = ConstantExpr::getIntToPtr(
+		ConstantInt::get(intptr_type, (uintptr_t)hook->function),
+		PointerType::getUnqual(type_func));
+	Value *result = CallInst::Create(v_func, args.begin(), args.end(), "", bb);
+
+	if (abi->sync_gpr_mask != 0)
+		reload_callout_state(cpu, abi->sync_gpr_mask, bb);
+
+	// the PC is still addr
+	if (abi->can_trap) {
+		BasicBlock *bb_return = BasicBlock::Create(_CTX(), "", cpu->cur_func, 0);
+		Value *trap = new ICmpInst(*bb, ICmpInst::ICMP_EQ, result,
+			ConstantInt::get(getIntegerType(64), CPU_HOOK_TRAP), "");
+		BranchInst::Create(bb_trap, bb_return, trap, bb);
+		bb = bb_return;
+	}
+
+	if (abi->ret_reg != CPU_HOOK_NO_REG)
+		hook_put_gpr(cpu, abi->ret_reg, result, bb);
+
+	// return to the caller
+	Value *ret_pc;
+	if (abi->return_kind == CPU_HOOK_RETURN_STACK)
+		ret_pc = hook_pop(cpu, abi, bb);
+	else
+		ret_pc = hook_get_gpr(cpu, abi->link_reg, bb);
+	ret_pc = hook_cast(ret_pc, address_size, bb);
+	if (abi->ret_adjust != 0)
+		ret_pc = BinaryOperator::Create(Instruction::Add, ret_pc,
+			ConstantInt::get(getIntegerType(address_size), abi->ret_adjust), "", bb);
+	new StoreInst(ret_pc, cpu->ptr_PC, bb);
+
+	BranchInst::Create(bb_dispatch, bb);
+}
+
+//////////////////////////////////////////////////////////////////////
+// interface
+//////////////////////////////////////////////////////////////////////
+
+/*
+ * calls to addr run f instead of the guest code; f == NULL removes
+ * the hook. Takes effect for code tagged and translated afterwards.
+ */
+void
+cpu_hook(cpu_t *cpu, addr_t addr, hook_function_t f, cpu_hook_abi_t const *abi)
+{
+	if (f == NULL) {
+		cpu->hooks.erase(addr);
+		return;
+	}
+
+	assert(abi->arg_count <= CPU_HOOK_MAX_ARGS && "too many hook arguments");
+	assert((abi->return_kind != CPU_HOOK_RETURN_STACK || abi->ret_size <= 8) &&
+		"return address too large");
+
+	cpu_hook_t hook;
+	hook.function = f;
+	hook.abi = *abi;
+	cpu->hooks[addr] = hook;
+}
@@ -0,0 +1,2 @@
+bool is_hooked(cpu_t *cpu, addr_t addr);
+void emit_hook(cpu_t *cpu, addr_t addr, BasicBlock *bb, BasicBlock *bb_dispatch, BasicBlock *bb_trap);
@@ -0,0 +1,138 @@
+/*
+ * libcpu: image.cpp
+ *
+ * Guest RAM allocation and loading of file images into it.
+ *
+ * Where the host can, the pages of an image are mapped copy-on-write
+ * (MAP_PRIVATE) over guest RAM, so they are read from disk when first
+ * touched and shared between guests running the same image. Parts
+ * that don't fill a whole page are read, since the rest of their page
+ * may belong to something else.
+ */
+
+#include "libcpu.h"
+
+#if HAVE_MMAP
+#define IMAGE_MMAP 1
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef IMAGE_MMAP
+
+static size_t
+image_page_size()
+{
+	static size_t page_size = 0;
+
+	if (page_size == 0)
+		page_size = sysconf(_SC_PAGESIZE);
+	return page_size;
+}
+
+/* read exactly `size' bytes at `offset', or fail */
+static bool
+image_read(int fd, uint8_t *dst, uint64_t offset, size_t size)
+{
+	while (size != 0) {
+		ssize_t n = pread(fd, dst, size, offset);
+		if (n <= 0)
+			return false;
+		dst += n;
+		offset += n;
+		size -= n;
+	}
+	return true;
+}
+
+int64_t
+cpu_map_image(cpu_t *cpu, char const *path, uint64_t offset, addr_t addr, uint64_t size)
+{
+	struct stat st;
+	uint8_t *dst = cpu->RAM + addr;
+	size_t page_size = image_page_size();
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < offset) {
+		close(fd);
+		return -1;
+	}
+	if (size > (uint64_t)st.st_size - offset)
+		size = st.st_size - offset;
+
+	size_t head = size, pages = 0;
+
+	/* file and RAM must be at the same offset within a page */
+	if (((uintptr_t)dst & (page_size - 1)) == (offset & (page_size - 1))) {
+		head = (page_size - ((uintptr_t)dst & (page_size - 1))) & (page_size - 1);
+		if (head > size)
+			head = size;
+		pages = (size - head) & ~(uint64_t)(page_size - 1);
+	}
+	size_t tail = size - head - pages;
+
+	bool ok = image_read(fd, dst, offset, head);
+	if (ok && pages != 0) {
+		void *p = mmap(dst + head, pages, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_FIXED, fd, offset + head);
+		if (p == MAP_FAILED)
+			ok = image_read(fd, dst + head, offset + head, pages);
+	}
+	if (ok)
+		ok = image_read(fd, dst + head + pages, offset + head + pages, tail);
+
+	close(fd);
+	return ok ? (int64_t)size : -1;
+}
+
+uint8_t *
+cpu_alloc_ram(size_t size)
+{
+	void *RAM = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANON, -1, 0);
+	return RAM == MAP_FAILED ? NULL : (uint8_t *)RAM;
+}
+
+void
+cpu_free_ram(uint8_t *RAM, size_t size)
+{
+	munmap(RAM, size);
+}
+
+#else /* !IMAGE_MMAP */
+
+/* no mmap, read the whole image */
+
+int64_t
+cpu_map_image(cpu_t *cpu, char const *path, uint64_t offset, addr_t addr, uint64_t size)
+{
+	FILE *f = fopen(path, "rb");
+	if (f == NULL)
+		return -1;
+	if (fseek(f, (long)offset, SEEK_SET) != 0) {
+		fclose(f);
+		return -1;
+	}
+	size_t n = fread(cpu->RAM + addr, 1, (size_t)size, f);
+	bool ok = !ferror(f);
+	fclose(f);
+	return ok ? (int64_t)n : -1;
+}
+
+uint8_t *
+cpu_alloc_ram(size_t size)
+{
+	return (uint8_t *)calloc(size, 1);
+}
+
+void
+cpu_free_ram(uint8_t *RAM, size_t size)
+{
+	free(RAM);
+}
+
+#endif /* IMAGE_MMAP */
@@ -6,6 +6,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 #include "llvm/Analysis/Verifier.h"
 #include "llvm/ExecutionEngine/JIT.h"
@@ -13,7 +16,6 @@
 #include "llvm/Module.h"
 #include "llvm/ModuleProvider.h"
 #include "llvm/Target/TargetData.h"
-#include "llvm/Target/TargetSelect.h"
 
 /* project global headers */
 #include "libcpu.h"
@@ -25,6 +27,11 @@
 #include "function.h"
 #include "optimize.h"
 #include "stat.h"
+#include "report.h"
+#include "snapshot.h"
+#include "coverage.h"
+#include "cache.h"
+#include "lock.h"
 
 /* architecture descriptors */
 extern arch_func_t arch_func_6502;
@@ -79,7 +86,7 @@ cpu_new(cpu_arch_t arch, uint32_t flags, uint32_t arch_flags)
 {
 	cpu_t *cpu;
 
-	llvm::InitializeNativeTarget();
+	libcpu_init();
 
 	cpu = new cpu_t;
 	assert(cpu != NULL);
@@ -122,6 +129,9 @@ cpu_new(cpu_arch_t arch, uint32_t flags, uint32_t arch_flags)
 	cpu->code_end = 0;
 	cpu->code_entry = 0;
 	cpu->tag = NULL;
+	cpu->RAM = NULL;
+	cpu->ram_size = 0;
+	cpu->snapshot = NULL;
 
 	uint32_t i;
 	for (i = 0; i < sizeof(cpu->func)/sizeof(*cpu->func); i++)
@@ -129,12 +139,35 @@ cpu_new(cpu_arch_t arch, uint32_t flags, uint32_t arch_flags)
 	for (i = 0; i < sizeof(cpu->fp)/sizeof(*cpu->fp); i++)
 		cpu->fp[i] = NULL;
 	cpu->functions = 0;
+	cpu->cur_func = NULL;
+	cpu->tags_dirty = false;
+	cpu->shared = NULL;
+	cpu->call_depth = 0;
+	cpu->cycles = 0;
 
 	cpu->flags_codegen = CPU_CODEGEN_OPTIMIZE;
 	cpu->flags_debug = CPU_DEBUG_NONE;
 	cpu->flags_hint = CPU_HINT_NONE;
 	cpu->flags = 0;
 
+	cpu->interrupt_pending = 0;
+	cpu->interrupt_function = NULL;
+	cpu->idle_function = NULL;
+
+	cpu->trap_function = NULL;
+	cpu->trap_gpr_mask = 0;
+
+	cpu->link_addr = ~0ULL;
+	cpu->link_value = 0;
+	cpu->link_scratch = 0;
+
+	cpu->coverage_map = NULL;
+	cpu->coverage_size = 0;
+	cpu->coverage_prev = 0;
+	cpu->coverage_alloc = false;
+
+	libcpu_lock();
+
 	// init the frontend
 	cpu->f.init(cpu, &cpu->info, &cpu->rf);
 
@@ -186,6 +219,8 @@ cpu_new(cpu_arch_t arch, uint32_t flags, uint32_t arch_flags)
 	assert(cpu->mod != NULL);
 	cpu->exec_engine = ExecutionEngine::create(cpu->mod);
 	assert(cpu->exec_engine != NULL);
+	/* subroutine functions are compiled with their callers, not through stubs */
+	cpu->exec_engine->DisableLazyCompilation();
 
 	// check if FP80 and FP128 are supported by this architecture.
 	// XXX there is a better way to do this?
@@ -204,20 +239,31 @@ cpu_new(cpu_arch_t arch, uint32_t flags, uint32_t arch_flags)
 			^ IS_LITTLE_ENDIAN(cpu))
 		cpu->flags |= CPU_FLAG_SWAPMEM;
 
+	report_init(cpu);
+
 	cpu->timer_total[TIMER_TAG] = 0;
 	cpu->timer_total[TIMER_FE] = 0;
 	cpu->timer_total[TIMER_BE] = 0;
 	cpu->timer_total[TIMER_RUN] = 0;
 
+	libcpu_unlock();
+
 	return cpu;
 }
 
 void
 cpu_free(cpu_t *cpu)
 {
+	if (cpu->shared != NULL)
+		cache_detach(cpu);
+
+	libcpu_lock();
+	snapshot_untrack(cpu);
+	coverage_done(cpu);
 	if (cpu->f.done != NULL)
 		cpu->f.done(cpu);
 	if (cpu->exec_engine != NULL) {
+		report_done(cpu);
 		if (cpu->cur_func != NULL) {
 			cpu->exec_engine->freeMachineCodeForFunction(cpu->cur_func);
 			cpu->cur_func->eraseFromParent();
@@ -238,6 +284,7 @@ cpu_free(cpu_t *cpu)
 		free(cpu->in_ptr_gpr);
 	if (cpu->ptr_gpr != NULL)
 		free(cpu->ptr_gpr);
+	libcpu_unlock();
 
 	delete cpu;
 }
@@ -248,6 +295,43 @@ cpu_set_ram(cpu_t*cpu, uint8_t *r)
 	cpu->RAM = r;
 }
 
+void
+cpu_set_ram_size(cpu_t *cpu, size_t size)
+{
+	cpu->ram_size = size;
+}
+
+/*
+ * Declare guest memory [start, end) immutable, e.g. ROM, so that loads
+ * from constant addresses in it become constants. It takes effect for
+ * code translated afterwards; neither the guest nor the client may
+ * change this memory any more.
+ */
+void
+cpu_set_readonly(cpu_t *cpu, addr_t start, addr_t end)
+{
+	range_map::iterator it;
+
+	if (start >= end)
+		return;
+
+	/* merge with overlapping or adjacent ranges */
+	it = cpu->readonly.upper_bound(start);
+	if (it != cpu->readonly.begin()) {
+		--it;
+		if (it->second < start)
+			++it;
+	}
+	while (it != cpu->readonly.end() && it->first <= end) {
+		if (it->first < start)
+			start = it->first;
+		if (it->second > end)
+			end = it->second;
+		cpu->readonly.erase(it++);
+	}
+	cpu->readonly[start] = end;
+}
+
 void
 cpu_set_flags_codegen(cpu_t *cpu, uint32_t f)
 {
@@ -270,7 +354,10 @@ void
 cpu_tag(cpu_t *cpu, addr_t pc)
 {
 	update_timing(cpu, TIMER_TAG, true);
-	tag_start(cpu, pc);
+	if (cpu->flags_codegen & CPU_CODEGEN_SHARE)
+		cache_tag(cpu, pc);
+	else
+		tag_start(cpu, pc);
 	update_timing(cpu, TIMER_TAG, false);
 }
 
@@ -282,6 +369,7 @@ cpu_translate_function(cpu_t *cpu)
 	/* create function and fill it with std basic blocks */
 	cpu->cur_func = cpu_create_function(cpu, "jitmain", &bb_ret, &bb_trap, &label_entry);
 	cpu->func[cpu->functions] = cpu->cur_func;
+	cpu->sub_func.clear();
 
 	/* TRANSLATE! */
 	update_timing(cpu, TIMER_FE, true);
@@ -299,10 +387,15 @@ cpu_translate_function(cpu_t *cpu)
 
 	/* make sure everything is OK */
 	verifyFunction(*cpu->cur_func, PrintMessageAction);
+	for (subfunc_map::const_iterator s = cpu->sub_func.begin(); s != cpu->sub_func.end(); s++)
+		verifyFunction(*s->second, PrintMessageAction);
 
 	if (cpu->flags_debug & CPU_DEBUG_PRINT_IR)
 		cpu->mod->dump();
 
+	if (REPORTING)
+		report_count_ir(cpu, false);
+
 	if (cpu->flags_codegen & CPU_CODEGEN_OPTIMIZE) {
 		LOG("*** Optimizing...");
 		optimize(cpu);
@@ -311,6 +404,9 @@ cpu_translate_function(cpu_t *cpu)
 			cpu->mod->dump();
 	}
 
+	if (REPORTING)
+		report_count_ir(cpu, true);
+
 	LOG("*** Translating...");
 	update_timing(cpu, TIMER_BE, true);
 	cpu->fp[cpu->functions] = cpu->exec_engine->getPointerToFunction(cpu->cur_func);
@@ -324,14 +420,22 @@ cpu_translate_function(cpu_t *cpu)
 void
 cpu_translate(cpu_t *cpu)
 {
+	if (cpu->flags_codegen & CPU_CODEGEN_SHARE) {
+		cache_translate(cpu);
+		return;
+	}
+
 	/* on demand translation */
-	if (cpu->tags_dirty)
+	if (cpu->tags_dirty) {
+		libcpu_lock();
 		cpu_translate_function(cpu);
+		libcpu_unlock();
+	}
 
 	cpu->tags_dirty = false;
 }
 
-typedef int (*fp_t)(uint8_t *RAM, void *grf, void *frf, debug_function_t fp);
+typedef int (*fp_t)(uint8_t *RAM, void *grf, void *frf, debug_function_t fp, cpu_t *cpu);
 
 #ifdef __GNUC__
 void __attribute__((noinline))
@@ -342,8 +446,8 @@ asm("nop");
 void breakpoint() {}
 #endif
 
-int
-cpu_run(cpu_t *cpu, debug_function_t debug_function)
+static int
+cpu_run_loop(cpu_t *cpu, bool budgeted, debug_function_t debug_function)
 {
 	addr_t pc = 0, orig_pc = 0;
 	uint32_t i;
@@ -364,9 +468,27 @@ cpu_run(cpu_t *cpu, debug_function_t debug_function)
 			fp_t FP = (fp_t)cpu->fp[i];
 			update_timing(cpu, TIMER_RUN, true);
 			breakpoint();
-			ret = FP(cpu->RAM, cpu->rf.grf, cpu->rf.frf, debug_function);
+			ret = FP(cpu->RAM, cpu->rf.grf, cpu->rf.frf, debug_function, cpu);
 			update_timing(cpu, TIMER_RUN, false);
 			pc = cpu->f.get_pc(cpu, cpu->rf.grf);
+			/* let the client handle the interrupt, then continue at the new PC */
+			if (ret == JIT_RETURN_INTERRUPT && cpu->interrupt_function != NULL &&
+				cpu->interrupt_function(cpu, cpu_ack_interrupt(cpu))) {
+				success = true;
+				break;
+			}
+			/* idle loop; let the client wait, or skip to the end of the budget */
+			if (ret == JIT_RETURN_IDLE) {
+				if (cpu->idle_function != NULL) {
+					if (!cpu->idle_function(cpu))
+						return ret;
+				} else if (budgeted)
+					cpu->budget = 0;
+				else
+					return ret;
+				success = true;
+				break;
+			}
 			if (ret != JIT_RETURN_FUNCNOTFOUND)
 				return ret;
 			if (!is_inside_code_area(cpu, pc))
@@ -385,13 +507,90 @@ cpu_run(cpu_t *cpu, debug_function_t debug_function)
 }
 //printf("%d\n", __LINE__);
 
+#define BUDGET_UNLIMITED ((int64_t)(~0ULL >> 1))
+
+int
+cpu_run(cpu_t *cpu, debug_function_t debug_function)
+{
+	cpu->budget = BUDGET_UNLIMITED;
+	return cpu_run_loop(cpu, false, debug_function);
+}
+
+/*
+ * runs until about 'budget' guest instructions have been executed.
+ * The last basic block may overrun the budget; the remainder (zero
+ * or negative) is left in cpu->budget.
+ */
+int
+cpu_run_for(cpu_t *cpu, int64_t budget, debug_function_t debug_function)
+{
+	assert((cpu->flags_codegen & CPU_CODEGEN_BUDGET) &&
+		"cpu_run_for() requires CPU_CODEGEN_BUDGET");
+	cpu->budget = budget;
+	return cpu_run_loop(cpu, true, debug_function);
+}
+
+void
+cpu_set_interrupt_function(cpu_t *cpu, interrupt_function_t f)
+{
+	cpu->interrupt_function = f;
+}
+
+void
+cpu_set_idle_function(cpu_t *cpu, idle_function_t f)
+{
+	cpu->idle_function = f;
+}
+
+/* marks interrupts as pending; translated code exits at the next basic block */
+void
+cpu_interrupt(cpu_t *cpu, uint32_t bits)
+{
+#ifdef _MSC_VER
+	_InterlockedOr((long volatile *)&cpu->interrupt_pending, bits);
+#else
+	__sync_fetch_and_or(&cpu->interrupt_pending, bits);
+#endif
+}
+
+/* returns and clears the pending interrupts */
+uint32_t
+cpu_ack_interrupt(cpu_t *cpu)
+{
+#ifdef _MSC_VER
+	return _InterlockedExchange((long volatile *)&cpu->interrupt_pending, 0);
+#else
+	return __sync_fetch_and_and(&cpu->interrupt_pending, 0);
+#endif
+}
+
 void
 cpu_flush(cpu_t *cpu)
 {
-	cpu->exec_engine->freeMachineCodeForFunction(cpu->cur_func);
-	cpu->cur_func->eraseFromParent();
+	/* the shared code stays with the other users */
+	if (cpu->shared != NULL) {
+		cpu->functions = 0;
+		return;
+	}
+
+	/* every jitmain() and the subroutines they call; they call each other */
+	std::vector<Function *> funcs(cpu->sub_funcs);
+	funcs.insert(funcs.end(), cpu->func, cpu->func + cpu->functions);
+
+	libcpu_lock();
+	for (size_t i = 0; i < funcs.size(); i++) {
+		cpu->exec_engine->freeMachineCodeForFunction(funcs[i]);
+		funcs[i]->dropAllReferences();
+	}
+	for (size_t i = 0; i < funcs.size(); i++)
+		funcs[i]->eraseFromParent();
+	libcpu_unlock();
 
 	cpu->functions = 0;
+	cpu->cur_func = NULL;
+	cpu->sub_func.clear();
+	cpu->sub_funcs.clear();
+	cpu->jump_tables.clear();
 
 	// reset bb caching mapping
 	cpu->func_bb.clear();
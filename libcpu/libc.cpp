@@ -0,0 +1,184 @@
+/*
+ * libcpu: libc.cpp
+ *
+ * Native replacements for the guest's libc memcpy, memset, strlen
+ * and bcopy, installed as hooks (see hook.cpp). Translated guest
+ * versions copy byte by byte through arch_load8()/arch_store8();
+ * the host versions work on guest RAM directly. RAM is always in
+ * guest byte order (CPU_FLAG_SWAPMEM only swaps loaded and stored
+ * values), so byte strings need no conversion.
+ *
+ * The routines are found by symbol, with cpu_hook_libc(), or by
+ * comparing a digest of the code at every called address with
+ * known digests, with cpu_recognize_libc(). Both need the size of
+ * RAM, see cpu_set_ram_size().
+ */
+
+#include "libcpu.h"
+#include "tag.h"
+#include "sha1.h"
+
+/*
+ * The arguments come from the guest; a range outside of RAM traps
+ * at the routine instead of touching host memory.
+ */
+static bool
+libc_in_ram(cpu_t *cpu, uint64_t addr, uint64_t n)
+{
+	return addr <= cpu->ram_size && n <= cpu->ram_size - addr;
+}
+
+static uint64_t
+libc_memmove(cpu_t *cpu, uint64_t dst, uint64_t src, uint64_t n)
+{
+	if (!libc_in_ram(cpu, dst, n) || !libc_in_ram(cpu, src, n))
+		return CPU_HOOK_TRAP;
+	memmove(&cpu->RAM[dst], &cpu->RAM[src], n);
+	return dst;
+}
+
+static uint64_t
+libc_bcopy(cpu_t *cpu, uint64_t src, uint64_t dst, uint64_t n)
+{
+	if (!libc_in_ram(cpu, dst, n) || !libc_in_ram(cpu, src, n))
+		return CPU_HOOK_TRAP;
+	memmove(&cpu->RAM[dst], &cpu->RAM[src], n);
+	return 0;
+}
+
+static uint64_t
+libc_memset(cpu_t *cpu, uint64_t dst, uint64_t c, uint64_t n)
+{
+	if (!libc_in_ram(cpu, dst, n))
+		return CPU_HOOK_TRAP;
+	memset(&cpu->RAM[dst], (int)(c & 0xff), n);
+	return dst;
+}
+
+static uint64_t
+libc_strlen(cpu_t *cpu, uint64_t s)
+{
+	if (s >= cpu->ram_size)
+		return CPU_HOOK_TRAP;
+	size_t max = cpu->ram_size - s;
+	size_t len = strnlen((char const *)&cpu->RAM[s], max);
+	return len == max ? CPU_HOOK_TRAP : len;	/* unterminated */
+}
+
+typedef struct {
+	char const *name;
+	hook_function_t function;
+	uint32_t arg_count;
+	bool has_result;
+} libc_routine_t;
+
+static libc_routine_t const libc_routines[] = {
+	{ "memcpy",  CPU_HOOK_FN(libc_memmove), 3, true },
+	{ "memmove", CPU_HOOK_FN(libc_memmove), 3, true },
+	{ "memset",  CPU_HOOK_FN(libc_memset),  3, true },
+	{ "strlen",  CPU_HOOK_FN(libc_strlen),  1, true },
+	{ "bcopy",   CPU_HOOK_FN(libc_bcopy),   3, false },
+	{ NULL, NULL, 0, false }
+};
+
+static libc_routine_t const *
+libc_find(char const *name)
+{
+	/* accept a.out style names */
+	if (name[0] == '_')
+		name++;
+
+	for (libc_routine_t const *r = libc_routines; r->name != NULL; r++)
+		if (strcmp(r->name, name) == 0)
+			return r;
+	return NULL;
+}
+
+/* the C calling convention of the architecture */
+static bool
+libc_abi(cpu_t *cpu, libc_routine_t const *r, cpu_hook_abi_t *abi)
+{
+	int first_arg, result, link;
+
+	switch (cpu->info.type) {
+		case CPU_ARCH_MIPS:
+			first_arg = 4; result = 2; link = 31;	/* a0, v0, ra */
+			break;
+		case CPU_ARCH_M88K:
+			first_arg = 2; result = 2; link = 1;
+			break;
+		case CPU_ARCH_ARM:
+			first_arg = 0; result = 0; link = 14;	/* r0, r0, lr */
+			break;
+		default:
+			return false;
+	}
+
+	memset(abi, 0, sizeof(*abi));
+	abi->arg_count = r->arg_count;
+	for (uint32_t i = 0; i < r->arg_count; i++)
+		abi->arg_reg[i] = first_arg + i;
+	abi->ret_reg = r->has_result ? result : CPU_HOOK_NO_REG;
+	abi->return_kind = CPU_HOOK_RETURN_LINK;
+	abi->link_reg = link;
+	abi->can_trap = true;
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// interface
+//////////////////////////////////////////////////////////////////////
+
+/*
+ * replaces the guest routine "name" at addr by the native one;
+ * returns false if there is no native version of the routine, the
+ * calling convention of the architecture is not known, or the size
+ * of RAM is not set.
+ */
+bool
+cpu_hook_libc(cpu_t *cpu, char const *name, addr_t addr)
+{
+	libc_routine_t const *r = libc_find(name);
+	cpu_hook_abi_t abi;
+
+	if (r == NULL || cpu->ram_size == 0 || !libc_abi(cpu, r, &abi))
+		return false;
+
+	LOG("libc: %s at $%08llx\n", r->name, (unsigned long long)addr);
+	cpu_hook(cpu, addr, r->function, &abi);
+	return true;
+}
+
+/*
+ * hooks every called address in the tagged code whose first
+ * size bytes have the SHA-1 digest of one of the known routines.
+ * Call after cpu_tag(); returns the number of routines hooked.
+ */
+int
+cpu_recognize_libc(cpu_t *cpu, cpu_libc_digest_t const *digests, size_t count)
+{
+	int found = 0;
+
+	for (addr_t pc = cpu->code_start; pc < cpu->code_end; pc++) {
+		if (!(get_tag(cpu, pc) & TAG_SUBROUTINE))
+			continue;
+
+		for (size_t i = 0; i < count; i++) {
+			uint8_t digest[SHA_DIGEST_LENGTH];
+			SHA1_CTX ctx;
+
+			if (pc + digests[i].size > cpu->code_end)
+				continue;
+
+			SHA1Init(&ctx);
+			SHA1Update(&ctx, &cpu->RAM[pc], digests[i].size);
+			SHA1Final(digest, &ctx);
+			if (memcmp(digest, digests[i].sha1, sizeof(digest)) == 0) {
+				if (cpu_hook_libc(cpu, digests[i].name, pc))
+					found++;
+				break;
+			}
+		}
+	}
+	return found;
+}
@@ -8,10 +8,13 @@
 #include <string.h>
 #include <stdint.h>
 #include <map>
+#include <string>
+#include <vector>
 
 namespace llvm {
 class BasicBlock;
 class ExecutionEngine;
+class JITEventListener;
 struct ExistingModuleProvider;
 class Function;
 class Module;
@@ -35,10 +38,14 @@ typedef addr_t      (*fp_get_pc)(struct cpu *cpu, void *regs);
 // @@@END_DEPRECATION
 typedef void        (*fp_emit_decode_reg)(struct cpu *cpu, BasicBlock *bb);
 typedef void        (*fp_spill_reg_state)(struct cpu *cpu, BasicBlock *bb);
+typedef void        (*fp_reload_reg_state)(struct cpu *cpu, BasicBlock *bb);
 typedef int         (*fp_tag_instr)(struct cpu *cpu, addr_t pc, tag_t *tag, addr_t *new_pc, addr_t *next_pc);
 typedef int         (*fp_disasm_instr)(struct cpu *cpu, addr_t pc, char *line, unsigned int max_line);
 typedef Value      *(*fp_translate_cond)(struct cpu *cpu, addr_t pc, BasicBlock *bb);
 typedef int         (*fp_translate_instr)(struct cpu *cpu, addr_t pc, BasicBlock *bb);
+typedef int         (*fp_jump_table)(struct cpu *cpu, addr_t pc, addr_t *targets, int max);
+typedef int         (*fp_cycles)(struct cpu *cpu, addr_t pc, int *taken);
+typedef int         (*fp_translate_fused)(struct cpu *cpu, addr_t pc, addr_t end, BasicBlock **bb);
 // @@@BEGIN_DEPRECATION
 // idbg support
 typedef uint64_t    (*fp_get_psr)(struct cpu *cpu, void *regs);
@@ -54,10 +61,14 @@ typedef struct {
 // @@@END_DEPRECATION
 	fp_emit_decode_reg emit_decode_reg;
 	fp_spill_reg_state spill_reg_state;
+	fp_reload_reg_state reload_reg_state; // decode again after a trap callout
 	fp_tag_instr tag_instr;
 	fp_disasm_instr disasm_instr;
 	fp_translate_cond translate_cond;
 	fp_translate_instr translate_instr;
+	fp_jump_table jump_table; // targets of an indirect branch through a table
+	fp_cycles cycles; // guest cycles of an instruction, see CPU_CODEGEN_CYCLES
+	fp_translate_fused translate_fused; // idioms of several instructions, see CPU_CODEGEN_FUSE
 // @@@BEGIN_DEPRECATION
 	// idbg support
 	fp_get_psr get_psr;
@@ -201,10 +212,76 @@ typedef struct cpu_archrf {
 	void *vrf; // Vector register file
 	// @@@END_DEPRECATION
 	void *storage;
+	size_t grf_size; // size of *grf, including the PC
+	size_t frf_size; // size of *frf
 } cpu_archrf_t;
 
 typedef std::map<addr_t, BasicBlock *> bbaddr_map;
 typedef std::map<Function *, bbaddr_map> funcbb_map;
+typedef std::map<addr_t, Function *> subfunc_map;
+typedef std::map<addr_t, std::vector<addr_t> > jumptable_map;
+typedef std::map<addr_t, addr_t> range_map;
+
+// high level emulation hooks, see cpu_hook()
+#define CPU_HOOK_MAX_ARGS 6
+#define CPU_HOOK_NO_REG (-1)
+// returned by a function with abi.can_trap: the hooked address traps
+// (JIT_RETURN_TRAP, with the PC there) instead of returning
+#define CPU_HOOK_TRAP (~(uint64_t)0)
+
+enum {
+	CPU_HOOK_RETURN_LINK = 0,	/* return address is in link_reg */
+	CPU_HOOK_RETURN_STACK		/* return address is popped from the stack */
+};
+
+typedef struct cpu_hook_abi {
+	uint32_t arg_count;				/* at most CPU_HOOK_MAX_ARGS */
+	int arg_reg[CPU_HOOK_MAX_ARGS];	/* GPR holding each argument */
+	int ret_reg;					/* GPR receiving the result, or CPU_HOOK_NO_REG */
+	uint32_t return_kind;			/* CPU_HOOK_RETURN_* */
+	int link_reg;					/* RETURN_LINK: GPR with the return address */
+	int sp_reg;						/* RETURN_STACK: GPR with the stack pointer */
+	addr_t stack_base;				/* RETURN_STACK: RAM address of sp 0 */
+	int stack_offset;				/* RETURN_STACK: return address is at sp + offset */
+	uint32_t ret_size;				/* RETURN_STACK: size of the return address in bytes */
+	int ret_adjust;					/* added to the return address (6502: 1) */
+	uint64_t sync_gpr_mask;			/* GPRs the function accesses through cpu->rf.grf;
+									   if not 0, the flags and XRs are synced too */
+	bool can_trap;					/* the function may return CPU_HOOK_TRAP */
+} cpu_hook_abi_t;
+
+/*
+ * type of a hook function: called with the cpu and abi.arg_count
+ * uint64_t arguments, returns the result for abi.ret_reg.
+ * Cast the actual function with CPU_HOOK_FN().
+ */
+typedef uint64_t (*hook_function_t)(struct cpu *cpu);
+#define CPU_HOOK_FN(f) ((hook_function_t)(f))
+
+typedef struct cpu_hook {
+	hook_function_t function;
+	cpu_hook_abi_t abi;
+} cpu_hook_t;
+
+typedef std::map<addr_t, cpu_hook_t> hook_map;
+
+// a guest libc routine, recognized by the digest of its code
+typedef struct cpu_libc_digest {
+	char const *name;	/* "memcpy", "memset", "strlen", "bcopy", ... */
+	uint32_t size;		/* number of bytes hashed */
+	uint8_t sha1[20];	/* SHA-1 of the first size bytes */
+} cpu_libc_digest_t;
+
+// translation report (CPU_DEBUG_REPORT)
+typedef struct report_entry {
+	uint64_t guest_instrs;	/* guest instructions translated */
+	uint64_t ir_before;		/* LLVM instructions before optimize() */
+	uint64_t ir_after;		/* LLVM instructions after optimize() */
+	uint64_t host_bytes;	/* emitted host code (estimated for blocks) */
+} report_entry_t;
+
+typedef std::map<addr_t, report_entry_t> report_block_map;
+typedef std::map<std::string, report_entry_t> report_opcode_map;
 
 typedef struct cpu {
 	cpu_archinfo_t info;
@@ -225,18 +302,60 @@ typedef struct cpu {
 	FILE *file_entries;
 	tag_t *tag;
 	bool tags_dirty;
+	jumptable_map jump_tables; /* targets of indirect branches, by branch address */
+	range_map readonly; /* immutable guest memory, start -> end */
 	Module *mod;
 	ExistingModuleProvider *mp;
 	void *fp[1024];
 	Function *func[1024];
 	Function *cur_func;
+	subfunc_map sub_func; /* subroutines of cur_func, see CPU_CODEGEN_SUBROUTINES */
+	std::vector<Function *> sub_funcs; /* subroutines of all functions, for cpu_flush() */
+	uint32_t call_depth; /* of calls between subroutine functions */
 	uint32_t functions;
 	ExecutionEngine *exec_engine;
 	uint8_t *RAM;
+	size_t ram_size; /* bytes of RAM, 0 if not known; see cpu_set_ram_size() */
+	struct cpu_snapshot *snapshot; /* RAM is tracked against this one */
+	struct cache_entry *shared; /* translation cache, see CPU_CODEGEN_SHARE */
 	Value *ptr_PC;
 	Value *ptr_RAM;
 	PointerType *type_pfunc_callout;
 	Value *ptr_func_debug;
+	Value *ptr_cpu; /* the cpu_t the code runs for */
+	Value *ptr_exit_code;
+
+	int64_t budget; /* instructions left for cpu_run_for() */
+	Value *ptr_budget;
+	Value *in_ptr_budget;
+
+	uint64_t cycles; /* guest cycles executed, see CPU_CODEGEN_CYCLES */
+	Value *ptr_cycles;
+	Value *in_ptr_cycles;
+
+	volatile uint32_t interrupt_pending; /* set by cpu_interrupt() */
+	bool (*interrupt_function)(struct cpu *cpu, uint32_t pending); /* see interrupt_function_t */
+	Value *ptr_interrupt_pending;
+
+	bool (*idle_function)(struct cpu *cpu); /* see idle_function_t */
+
+	int (*trap_function)(struct cpu *cpu); /* see trap_function_t */
+	uint64_t trap_gpr_mask; /* GPRs synced around trap_function */
+
+	hook_map hooks; /* host functions replacing guest code */
+
+	uint64_t link_addr; /* reserved by the last load linked, or ~0 */
+	uint32_t link_value; /* what it loaded, in RAM byte order */
+	uint32_t link_scratch; /* target of failing store conditionals */
+
+	uint8_t *coverage_map; /* AFL style edge counters */
+	uint32_t coverage_size; /* power of two */
+	uint32_t coverage_prev; /* previous block id >> 1 */
+	bool coverage_alloc; /* map allocated by libcpu */
+	Value *ptr_coverage_map;
+	Value *ptr_coverage_mask;
+	Value *ptr_coverage_prev;
+	Value *in_ptr_coverage_prev;
 
 	Value *ptr_grf; // gpr register file
 	Value **ptr_gpr; // GPRs
@@ -258,6 +377,11 @@ typedef struct cpu {
 	uint64_t timer_total[TIMER_COUNT];
 	uint64_t timer_start[TIMER_COUNT];
 
+	report_block_map report_block; /* per basic block, keyed by guest address */
+	report_opcode_map report_opcode; /* per mnemonic */
+	report_entry_t report_total;
+	JITEventListener *report_listener;
+
 	void *feptr; /* This pointer can be used freely by the frontend. */
 } cpu_t;
 
@@ -265,7 +389,10 @@ enum {
 	JIT_RETURN_NOERR = 0,
 	JIT_RETURN_FUNCNOTFOUND,
 	JIT_RETURN_SINGLESTEP,
-	JIT_RETURN_TRAP
+	JIT_RETURN_TRAP,
+	JIT_RETURN_BUDGET,
+	JIT_RETURN_INTERRUPT,
+	JIT_RETURN_IDLE
 };
 
 //////////////////////////////////////////////////////////////////////
@@ -287,6 +414,64 @@ enum {
 // cache exists.
 #define CPU_CODEGEN_TAG_LIMIT (1<<2)
 
+// Every basic block subtracts its number of guest instructions
+// from cpu->budget on entry, and returns JIT_RETURN_BUDGET
+// before executing the block if the budget is used up.
+// Required for cpu_run_for(). Ignored when single stepping.
+#define CPU_CODEGEN_BUDGET (1<<3)
+
+// Every basic block polls cpu->interrupt_pending on entry, and
+// returns JIT_RETURN_INTERRUPT before executing the block if
+// cpu_interrupt() has been called. Backward branches always
+// target the start of a basic block, so loops are covered.
+#define CPU_CODEGEN_INTERRUPTS (1<<4)
+
+// Every executed basic block counts the edge it was entered
+// through in cpu->coverage_map, like AFL does. Blocks that can
+// only be reached from the conditional instruction before them
+// are not instrumented. See cpu_set_coverage_map().
+#define CPU_CODEGEN_COVERAGE (1<<5)
+
+// Tags and host code are shared with every other cpu that has
+// the same code in its code area and the same flags, hooks and
+// trap function. RAM and the register files stay private.
+// Tagging and translation are serialized per shared entry.
+#define CPU_CODEGEN_SHARE (1<<6)
+
+// Every subroutine (target of a guest call) is also translated into
+// its own function, and guest calls of it become host calls. After
+// the call, execution continues in the caller if the subroutine
+// returned to the instruction after the call; otherwise through the
+// dispatcher. Small subroutines that call no others are inlined.
+#define CPU_CODEGEN_SUBROUTINES (1<<7)
+
+// Every basic block adds the guest cycles of its instructions, as
+// the frontend's cycles function tells them, to cpu->cycles on entry.
+// Taken conditional branches and other variable costs (e.g. 6502 page
+// crossings) add their extra cycles where they happen. Hooks and the
+// trap function see the count including their whole basic block.
+// Frontends without a cycles function count one cycle per instruction.
+#define CPU_CODEGEN_CYCLES (1<<8)
+
+// Basic blocks that branch back to themselves and only poll memory
+// (idle loops) return JIT_RETURN_IDLE instead of branching back, with
+// the PC at their start. cpu_run() then calls the idle function, see
+// idle_function_t.
+#define CPU_CODEGEN_IDLE (1<<9)
+
+// The frontend's translate_fused function may translate a sequence of
+// instructions (an idiom, e.g. a 16 bit add on an 8 bit CPU) as a
+// whole, which is shorter than translating them one by one. The
+// sequence lies within a basic block, or spans a run of conditional
+// instructions. Ignored when single stepping.
+#define CPU_CODEGEN_FUSE (1<<10)
+
+// Guest loops are also translated into copies that can only be entered
+// through their header, so LLVM optimizes them as loops. This may hoist
+// RAM loads out of a loop: a loop that polls RAM another cpu or thread
+// writes no longer sees the writes. Do not use it for such code.
+#define CPU_CODEGEN_LOOPS (1<<11)
+
 //////////////////////////////////////////////////////////////////////
 // debug flags
 //////////////////////////////////////////////////////////////////////
@@ -297,6 +482,7 @@ enum {
 #define CPU_DEBUG_PRINT_IR_OPTIMIZED	(1<<3)
 #define CPU_DEBUG_LOG					(1<<4)
 #define CPU_DEBUG_PROFILE				(1<<5)
+#define CPU_DEBUG_REPORT				(1<<6) // collect data for cpu_print_translation_report()
 #define CPU_DEBUG_ALL 0xFFFFFFFF
 
 //////////////////////////////////////////////////////////////////////
@@ -321,8 +507,51 @@ enum {
  */
 typedef void (*debug_function_t)(cpu_t*);
 
+/*
+ * type of the interrupt callback; called by cpu_run() with the
+ * acknowledged interrupt bits and the guest state up to date.
+ * Return true to continue running at the (possibly changed) PC,
+ * false to return JIT_RETURN_INTERRUPT to the client.
+ */
+typedef bool (*interrupt_function_t)(cpu_t*, uint32_t pending);
+
+/*
+ * type of the idle callback; called by cpu_run() when the guest
+ * spins in an idle loop (see CPU_CODEGEN_IDLE), with the guest state
+ * up to date. It may wait for an interrupt or a device, skip ahead in
+ * time, or yield the host thread. Return true to continue running the
+ * guest, false to return JIT_RETURN_IDLE to the client.
+ * Without one, cpu_run_for() ends the budget early, as the loop would
+ * have spun until then, and cpu_run() returns JIT_RETURN_IDLE.
+ */
+typedef bool (*idle_function_t)(cpu_t*);
+
+/*
+ * type of the trap callout; called directly from translated code
+ * for every trap instruction, with the PC, the XRs, the flags and
+ * the GPRs of the mask passed to cpu_set_trap_function() in the
+ * register file. Return CPU_TRAP_RESUME to continue at the
+ * (possibly changed) PC, or CPU_TRAP_EXIT to return
+ * JIT_RETURN_TRAP to the client.
+ */
+typedef int (*trap_function_t)(cpu_t*);
+
+enum {
+	CPU_TRAP_RESUME = 0,
+	CPU_TRAP_EXIT
+};
+
 //////////////////////////////////////////////////////////////////////
 
+/*
+ * Thread safety: every cpu_t may be used by one thread at a time,
+ * and different cpu_ts may be used by different threads at the same
+ * time. Creating, translating and freeing cpus takes a process wide
+ * lock, since all of them share the LLVM context; running translated
+ * code does not, so independent guests scale with the host cores once
+ * their code is translated. Snapshots and CPU_CODEGEN_SHARE may be
+ * used from several threads as well.
+ */
 API_FUNC cpu_t *cpu_new(cpu_arch_t arch, uint32_t flags, uint32_t arch_flags);
 API_FUNC void cpu_free(cpu_t *cpu);
 API_FUNC void cpu_set_flags_codegen(cpu_t *cpu, uint32_t f);
@@ -330,11 +559,38 @@ API_FUNC void cpu_set_flags_hint(cpu_t *cpu, uint32_t f);
 API_FUNC void cpu_set_flags_debug(cpu_t *cpu, uint32_t f);
 API_FUNC void cpu_tag(cpu_t *cpu, addr_t pc);
 API_FUNC int cpu_run(cpu_t *cpu, debug_function_t debug_function);
+API_FUNC int cpu_run_for(cpu_t *cpu, int64_t budget, debug_function_t debug_function);
 API_FUNC void cpu_translate(cpu_t *cpu);
 API_FUNC void cpu_set_ram(cpu_t *cpu, uint8_t *RAM);
+/* bounds guest RAM for host functions, see cpu_hook_libc() */
+API_FUNC void cpu_set_ram_size(cpu_t *cpu, size_t size);
+/* guest memory [start, end) is never written; loads from it are folded */
+API_FUNC void cpu_set_readonly(cpu_t *cpu, addr_t start, addr_t end);
+API_FUNC void cpu_set_coverage_map(cpu_t *cpu, uint8_t *map, uint32_t size);
 API_FUNC void cpu_flush(cpu_t *cpu);
+API_FUNC void cpu_set_interrupt_function(cpu_t *cpu, interrupt_function_t f);
+API_FUNC void cpu_set_idle_function(cpu_t *cpu, idle_function_t f);
+API_FUNC void cpu_set_trap_function(cpu_t *cpu, trap_function_t f, uint64_t gpr_mask);
+API_FUNC void cpu_hook(cpu_t *cpu, addr_t addr, hook_function_t f, cpu_hook_abi_t const *abi);
+/* native replacements for guest libc routines */
+API_FUNC bool cpu_hook_libc(cpu_t *cpu, char const *name, addr_t addr);
+API_FUNC int cpu_recognize_libc(cpu_t *cpu, cpu_libc_digest_t const *digests, size_t count);
+/* these two may be called from other threads or signal handlers */
+API_FUNC void cpu_interrupt(cpu_t *cpu, uint32_t bits);
+API_FUNC uint32_t cpu_ack_interrupt(cpu_t *cpu);
 API_FUNC void cpu_print_statistics(cpu_t *cpu);
 
+/* snapshots of RAM and registers */
+typedef struct cpu_snapshot cpu_snapshot_t;
+API_FUNC cpu_snapshot_t *cpu_snapshot(cpu_t *cpu, size_t ram_size);
+API_FUNC void cpu_restore(cpu_t *cpu, cpu_snapshot_t *snapshot);
+API_FUNC void cpu_snapshot_free(cpu_t *cpu, cpu_snapshot_t *snapshot);
+API_FUNC void cpu_print_translation_report(cpu_t *cpu);
+/* guest RAM, and file images loaded lazily into it */
+API_FUNC uint8_t *cpu_alloc_ram(size_t size);
+API_FUNC void cpu_free_ram(uint8_t *RAM, size_t size);
+API_FUNC int64_t cpu_map_image(cpu_t *cpu, char const *path, uint64_t offset, addr_t addr, uint64_t size);
+
 /* runs the interactive debugger */
 API_FUNC int cpu_debugger(cpu_t *cpu, debug_function_t debug_function);
 
@@ -0,0 +1,83 @@
+/*
+ * libcpu: lock.cpp
+ *
+ * One time initialization of LLVM, and the lock that serializes
+ * everything that uses it.
+ *
+ * All cpus share the global LLVM context, and LLVM 2.6 types and
+ * constants are uniqued in it, so creating, translating and freeing
+ * cpus takes a process wide lock. Running translated code does not;
+ * independent cpus run in parallel once their code is translated.
+ */
+
+#include "llvm/System/Threading.h"
+#include "llvm/Target/TargetSelect.h"
+
+#include "libcpu.h"
+#include "lock.h"
+
+#if HAVE_PTHREAD_H
+#include <pthread.h>
+
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t llvm_lock;
+
+static void
+init_llvm()
+{
+	pthread_mutexattr_t attr;
+
+	/* cpu_new() of a shared translator runs under the lock */
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&llvm_lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	llvm::llvm_start_multithreaded();
+	llvm::InitializeNativeTarget();
+}
+
+void
+libcpu_init()
+{
+	pthread_once(&init_once, init_llvm);
+}
+
+void
+libcpu_lock()
+{
+	pthread_mutex_lock(&llvm_lock);
+}
+
+void
+libcpu_unlock()
+{
+	pthread_mutex_unlock(&llvm_lock);
+}
+
+#else /* !HAVE_PTHREAD_H */
+
+/* no threads, a single cpu_new() at a time */
+
+void
+libcpu_init()
+{
+	static bool initialized = false;
+
+	if (!initialized) {
+		llvm::InitializeNativeTarget();
+		initialized = true;
+	}
+}
+
+void
+libcpu_lock()
+{
+}
+
+void
+libcpu_unlock()
+{
+}
+
+#endif /* HAVE_PTHREAD_H */
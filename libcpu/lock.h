@@ -0,0 +1,3 @@
+void libcpu_init();
+void libcpu_lock();
+void libcpu_unlock();
@@ -4,26 +4,117 @@
  * Tell LLVM to run optimizers over the IR.
  */
 
+#include <set>
+#include <vector>
+
 #include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/Instructions.h"
 #include "llvm/ModuleProvider.h"
 #include "llvm/PassManager.h"
 #include "llvm/Support/StandardPasses.h"
 #include "llvm/Target/TargetData.h"
+#include "llvm/Transforms/Utils/Cloning.h"
 
 #include "libcpu.h"
+#include "passes.h"
+
+static size_t
+count_instructions(Function *f)
+{
+	size_t n = 0;
+	for (Function::iterator it = f->begin(); it != f->end(); it++)
+		n += it->size();
+	return n;
+}
+
+/* optimized subroutines up to this size that call no others are inlined */
+#define INLINE_LIMIT 200
+
+static bool
+calls_subroutine(Function *f, std::set<Function *> const &subs)
+{
+	for (Function::iterator b = f->begin(); b != f->end(); b++)
+		for (BasicBlock::iterator i = b->begin(); i != b->end(); i++)
+			if (CallInst *ci = dyn_cast<CallInst>(i))
+				if (subs.count(ci->getCalledFunction()))
+					return true;
+	return false;
+}
+
+/* inline small leaf subroutines, see CPU_CODEGEN_SUBROUTINES */
+static void
+inline_subroutines(cpu_t *cpu, TargetData *TD, std::set<Function *> &changed)
+{
+	std::set<Function *> subs;
+	subfunc_map::const_iterator s;
+
+	for (s = cpu->sub_func.begin(); s != cpu->sub_func.end(); s++)
+		subs.insert(s->second);
+
+	for (s = cpu->sub_func.begin(); s != cpu->sub_func.end(); s++) {
+		Function *f = s->second;
+		if (count_instructions(f) > INLINE_LIMIT || calls_subroutine(f, subs))
+			continue;
+
+		std::vector<CallInst *> calls;
+		for (Value::use_iterator u = f->use_begin(); u != f->use_end(); u++)
+			if (CallInst *ci = dyn_cast<CallInst>(*u))
+				calls.push_back(ci);
+
+		for (size_t i = 0; i < calls.size(); i++) {
+			Function *caller = calls[i]->getParent()->getParent();
+			if (InlineFunction(calls[i], NULL, TD))
+				changed.insert(caller);
+		}
+		LOG("(inlined sub_%08llx %zu times) ", (unsigned long long)s->first, calls.size());
+	}
+}
 
 void
 optimize(cpu_t *cpu)
 {
 	FunctionPassManager pm = FunctionPassManager(cpu->mp);
+	size_t before = count_instructions(cpu->cur_func);
 
 	std::string data_layout = cpu->exec_engine->getTargetData()->getStringRepresentation();
 	TargetData *TD = new TargetData(data_layout);
 	pm.add(TD);
+	/* RAM, GPRs and FPRs are noalias arguments, see cpu_declare_function() */
+	pm.add(createBasicAliasAnalysisPass());
 	pm.add(createPromoteMemoryToRegisterPass());
 	pm.add(createInstructionCombiningPass());
+	/* loops, see find_loops() */
+	if (cpu->flags_codegen & CPU_CODEGEN_LOOPS) {
+		pm.add(createCFGSimplificationPass());
+		pm.add(createLoopRotatePass());
+		pm.add(createLICMPass());
+		pm.add(createIndVarSimplifyPass());
+		pm.add(createInstructionCombiningPass());
+	}
+	pm.add(createGVNPass());
+	/* what GVN forwarded through memory, see passes.cpp */
+	pm.add(createSwapEliminationPass());
+	pm.add(createFlagBitFoldingPass());
+	pm.add(createDeadStoreEliminationPass());
+	pm.add(createRegisterStoreEliminationPass());
 	pm.add(createConstantPropagationPass());
 	pm.add(createDeadCodeEliminationPass());
+
+	/* subroutines first, their optimized size decides about inlining */
+	if (!cpu->sub_func.empty()) {
+		std::set<Function *> changed;
+		subfunc_map::const_iterator s;
+
+		for (s = cpu->sub_func.begin(); s != cpu->sub_func.end(); s++)
+			pm.run(*s->second);
+		inline_subroutines(cpu, TD, changed);
+		for (std::set<Function *>::const_iterator f = changed.begin(); f != changed.end(); f++)
+			if (*f != cpu->cur_func)
+				pm.run(**f);
+	}
+
 	pm.run(*cpu->cur_func);
+
+	LOG("(%zu -> %zu IR instructions) ", before, count_instructions(cpu->cur_func));
 }
 
@@ -0,0 +1,472 @@
+/*
+ * libcpu: passes.cpp
+ *
+ * Optimizer passes for patterns that are typical for the code libcpu
+ * generates, and that the standard LLVM passes don't remove:
+ *
+ * - stores to the register file that are overwritten on every path
+ *   before anything can read them, mostly of the PC (emit_store_pc())
+ * - byte swaps that cancel each other, from copying memory with
+ *   CPU_FLAG_SWAPMEM
+ * - single flag bits taken out of a PSR that has just been put
+ *   together from them (arch_flags_encode() / arch_flags_decode())
+ */
+
+#include <algorithm>
+#include <set>
+#include <vector>
+
+#include "llvm/Constants.h"
+#include "llvm/Instructions.h"
+#include "llvm/IntrinsicInst.h"
+#include "llvm/Pass.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Target/TargetData.h"
+#include "llvm/Transforms/Utils/Local.h"
+
+#include "libcpu.h"
+#include "passes.h"
+
+static size_t
+count_instructions(Function &F)
+{
+	size_t n = 0;
+	for (Function::iterator it = F.begin(); it != F.end(); it++)
+		n += it->size();
+	return n;
+}
+
+/* replace an instruction, and delete what is no longer needed */
+static void
+replace_instruction(Instruction *I, Value *v)
+{
+	I->replaceAllUsesWith(v);
+	RecursivelyDeleteTriviallyDeadInstructions(I);
+}
+
+//////////////////////////////////////////////////////////////////////
+// register file stores
+//////////////////////////////////////////////////////////////////////
+
+/* give up on paths that are longer than this */
+#define STORE_SCAN_LIMIT 1000
+
+namespace {
+	struct RegisterStoreElimination : public FunctionPass {
+		static char ID;
+		AliasAnalysis *AA;
+		TargetData *TD;
+
+		RegisterStoreElimination() : FunctionPass(&ID) {}
+
+		virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+			AU.setPreservesCFG();
+			AU.addRequired<AliasAnalysis>();
+		}
+
+		virtual bool runOnFunction(Function &F);
+
+	private:
+		bool is_register(Value *ptr);
+		bool is_dead(StoreInst *SI, BasicBlock::iterator it,
+			std::set<BasicBlock *> &visited, size_t &scanned);
+	};
+}
+
+char RegisterStoreElimination::ID = 0;
+
+/* the GPR and FPR files are the 2nd and 3rd argument, see cpu_declare_function() */
+bool
+RegisterStoreElimination::is_register(Value *ptr)
+{
+	Argument *arg = dyn_cast<Argument>(ptr->getUnderlyingObject());
+	return arg != NULL && (arg->getArgNo() == 1 || arg->getArgNo() == 2);
+}
+
+/*
+ * whether the store is overwritten on all paths starting at `it'
+ * before it can be read; the register file is read after the
+ * function returned, and by everything that gets the cpu_t
+ */
+bool
+RegisterStoreElimination::is_dead(StoreInst *SI, BasicBlock::iterator it,
+	std::set<BasicBlock *> &visited, size_t &scanned)
+{
+	Value *ptr = SI->getPointerOperand();
+	unsigned size = TD->getTypeStoreSize(SI->getOperand(0)->getType());
+	BasicBlock *bb = it->getParent();
+
+	for (; it != bb->end(); it++) {
+		Instruction *I = it;
+
+		if (++scanned > STORE_SCAN_LIMIT)
+			return false;
+
+		if (StoreInst *S = dyn_cast<StoreInst>(I)) {
+			unsigned s = TD->getTypeStoreSize(S->getOperand(0)->getType());
+			if (s >= size && AA->alias(S->getPointerOperand(), s, ptr, size) == AliasAnalysis::MustAlias)
+				return true;
+		} else if (LoadInst *L = dyn_cast<LoadInst>(I)) {
+			unsigned s = TD->getTypeStoreSize(L->getType());
+			if (AA->alias(L->getPointerOperand(), s, ptr, size) != AliasAnalysis::NoAlias)
+				return false;
+		} else if (CallInst *CI = dyn_cast<CallInst>(I)) {
+			Function *callee = CI->getCalledFunction();
+			if (callee == NULL || !callee->doesNotAccessMemory())
+				return false;
+		} else if (isa<ReturnInst>(I) || isa<UnwindInst>(I))
+			return false;
+		else if (I->mayReadFromMemory())
+			return false;
+	}
+
+	/* all successors must overwrite it; a path back to a block
+	   that is being looked at already doesn't read it either */
+	TerminatorInst *T = bb->getTerminator();
+	for (unsigned i = 0; i < T->getNumSuccessors(); i++) {
+		BasicBlock *succ = T->getSuccessor(i);
+		if (!visited.insert(succ).second)
+			continue;
+		if (!is_dead(SI, succ->begin(), visited, scanned))
+			return false;
+	}
+	return T->getNumSuccessors() != 0;
+}
+
+bool
+RegisterStoreElimination::runOnFunction(Function &F)
+{
+	AA = &getAnalysis<AliasAnalysis>();
+	TD = getAnalysisIfAvailable<TargetData>();
+	if (TD == NULL)
+		return false;
+
+	size_t before = count_instructions(F);
+	std::vector<StoreInst *> dead;
+
+	for (Function::iterator bb = F.begin(); bb != F.end(); bb++) {
+		for (BasicBlock::iterator it = bb->begin(); it != bb->end(); it++) {
+			StoreInst *SI = dyn_cast<StoreInst>(it);
+			if (SI == NULL || SI->isVolatile() || !is_register(SI->getPointerOperand()))
+				continue;
+
+			std::set<BasicBlock *> visited;
+			size_t scanned = 0;
+			BasicBlock::iterator next = it;
+			if (is_dead(SI, ++next, visited, scanned))
+				dead.push_back(SI);
+		}
+	}
+
+	for (size_t i = 0; i < dead.size(); i++) {
+		Value *v = dead[i]->getOperand(0);
+		dead[i]->eraseFromParent();
+		RecursivelyDeleteTriviallyDeadInstructions(v);
+	}
+
+	if (!dead.empty())
+		LOG("(register stores: %zu -> %zu) ", before, count_instructions(F));
+	return !dead.empty();
+}
+
+//////////////////////////////////////////////////////////////////////
+// byte swaps
+//////////////////////////////////////////////////////////////////////
+
+/* look through at most this many bitwise operations */
+#define SWAP_DEPTH 4
+
+namespace {
+	struct SwapElimination : public FunctionPass {
+		static char ID;
+
+		SwapElimination() : FunctionPass(&ID) {}
+
+		virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+			AU.setPreservesCFG();
+		}
+
+		virtual bool runOnFunction(Function &F);
+	};
+}
+
+char SwapElimination::ID = 0;
+
+static bool
+is_bswap(Value *v)
+{
+	IntrinsicInst *II = dyn_cast<IntrinsicInst>(v);
+	return II != NULL && II->getIntrinsicID() == Intrinsic::bswap;
+}
+
+/*
+ * whether v can be byte swapped without adding a swap: constants,
+ * swapped values, and bitwise operations of those
+ */
+static bool
+swap_is_free(Value *v, int depth)
+{
+	if (isa<ConstantInt>(v) || is_bswap(v))
+		return true;
+
+	BinaryOperator *BO = dyn_cast<BinaryOperator>(v);
+	if (BO == NULL || !BO->hasOneUse() || depth == SWAP_DEPTH)
+		return false;
+	switch (BO->getOpcode()) {
+		case Instruction::And:
+		case Instruction::Or:
+		case Instruction::Xor:
+			return swap_is_free(BO->getOperand(0), depth + 1) &&
+				swap_is_free(BO->getOperand(1), depth + 1);
+		default:
+			return false;
+	}
+}
+
+/* v byte swapped, for which swap_is_free() holds */
+static Value *
+swap_value(Value *v, Instruction *before)
+{
+	if (ConstantInt *c = dyn_cast<ConstantInt>(v))
+		return ConstantInt::get(v->getContext(), c->getValue().byteSwap());
+	if (is_bswap(v))
+		return cast<IntrinsicInst>(v)->getOperand(1);
+
+	BinaryOperator *BO = cast<BinaryOperator>(v);
+	return BinaryOperator::Create(BO->getOpcode(),
+		swap_value(BO->getOperand(0), before),
+		swap_value(BO->getOperand(1), before), "", before);
+}
+
+bool
+SwapElimination::runOnFunction(Function &F)
+{
+	size_t before = count_instructions(F);
+	bool changed = false;
+
+	for (Function::iterator bb = F.begin(); bb != F.end(); bb++) {
+		for (BasicBlock::iterator it = bb->begin(); it != bb->end(); ) {
+			Instruction *I = it++;
+
+			/* bswap(bswap(x)) -> x, bswap(bswap(x) & C) -> x & bswap(C) */
+			if (is_bswap(I)) {
+				Value *v = I->getOperand(1);
+				if (isa<ConstantInt>(v) || !swap_is_free(v, 0))
+					continue;
+				replace_instruction(I, swap_value(v, I));
+				changed = true;
+				continue;
+			}
+
+			/* bswap(x) == bswap(y) -> x == y */
+			if (ICmpInst *CI = dyn_cast<ICmpInst>(I)) {
+				Value *a = CI->getOperand(0), *b = CI->getOperand(1);
+				if (!CI->isEquality() || !(is_bswap(a) || is_bswap(b)) ||
+					!swap_is_free(a, SWAP_DEPTH) || !swap_is_free(b, SWAP_DEPTH))
+					continue;
+				Value *cmp = new ICmpInst(I, CI->getPredicate(),
+					swap_value(a, I), swap_value(b, I));
+				replace_instruction(I, cmp);
+				changed = true;
+			}
+		}
+	}
+
+	if (changed)
+		LOG("(byte swaps: %zu -> %zu) ", before, count_instructions(F));
+	return changed;
+}
+
+//////////////////////////////////////////////////////////////////////
+// flag bits
+//////////////////////////////////////////////////////////////////////
+
+/* look at most at this many values for a bit */
+#define BIT_BUDGET 64
+
+namespace {
+	struct FlagBitFolding : public FunctionPass {
+		static char ID;
+
+		FlagBitFolding() : FunctionPass(&ID) {}
+
+		virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+			AU.setPreservesCFG();
+		}
+
+		virtual bool runOnFunction(Function &F);
+	};
+}
+
+char FlagBitFolding::ID = 0;
+
+/*
+ * bit `bit' of v as an i1, inverted if *inv is set, if it can be
+ * followed to a constant or to a boolean that was put into v;
+ * NULL otherwise
+ */
+static Value *
+get_bit(Value *v, unsigned bit, bool *inv, unsigned *budget)
+{
+	LLVMContext &ctx = v->getContext();
+	unsigned width = cast<IntegerType>(v->getType())->getBitWidth();
+
+	*inv = false;
+	if (bit >= width)
+		return ConstantInt::getFalse(ctx);
+	if (ConstantInt *c = dyn_cast<ConstantInt>(v))
+		return c->getValue()[bit] ? ConstantInt::getTrue(ctx) : ConstantInt::getFalse(ctx);
+	if (width == 1)
+		return v;
+	if (*budget == 0)
+		return NULL;
+	--*budget;
+
+	if (ZExtInst *ZI = dyn_cast<ZExtInst>(v))
+		return get_bit(ZI->getOperand(0), bit, inv, budget);
+
+	BinaryOperator *BO = dyn_cast<BinaryOperator>(v);
+	if (BO == NULL)
+		return NULL;
+
+	ConstantInt *c = dyn_cast<ConstantInt>(BO->getOperand(1));
+	switch (BO->getOpcode()) {
+		case Instruction::Shl:
+			if (c == NULL)
+				return NULL;
+			if (bit < c->getZExtValue())
+				return ConstantInt::getFalse(ctx);
+			return get_bit(BO->getOperand(0), bit - c->getZExtValue(), inv, budget);
+		case Instruction::LShr:
+			if (c == NULL)
+				return NULL;
+			return get_bit(BO->getOperand(0), bit + c->getZExtValue(), inv, budget);
+		case Instruction::And:
+		case Instruction::Or:
+		case Instruction::Xor:
+			break;
+		default:
+			return NULL;
+	}
+
+	bool inv_a, inv_b;
+	Value *a = get_bit(BO->getOperand(0), bit, &inv_a, budget);
+	Value *b = get_bit(BO->getOperand(1), bit, &inv_b, budget);
+	if (a == NULL || b == NULL)
+		return NULL;
+
+	/* only where a constant decides, no new and/or of unknown bits */
+	if (!isa<ConstantInt>(a)) {
+		std::swap(a, b);
+		std::swap(inv_a, inv_b);
+	}
+	ConstantInt *ca = dyn_cast<ConstantInt>(a);
+	if (ca == NULL)
+		return NULL;
+
+	switch (BO->getOpcode()) {
+		case Instruction::And:
+			if (ca->isZero())
+				return ca;
+			break;
+		case Instruction::Or:
+			if (ca->isOne())
+				return ca;
+			break;
+		default: /* Xor */
+			inv_b ^= ca->isOne();
+			break;
+	}
+	if (ConstantInt *cb = dyn_cast<ConstantInt>(b))
+		return inv_b ? ConstantInt::get(ctx, ~cb->getValue()) : cb;
+	*inv = inv_b;
+	return b;
+}
+
+/*
+ * the bit an instruction tests, as arch_decode_bit() and
+ * instcombine generate it: trunc (lshr x, n) to i1, or
+ * icmp eq/ne (and x, 1 << n), 0; NULL if it doesn't
+ */
+static Value *
+get_tested_bit(Instruction *I, unsigned *bit, bool *inverted)
+{
+	*inverted = false;
+
+	if (TruncInst *TI = dyn_cast<TruncInst>(I)) {
+		if (TI->getType() != Type::getInt1Ty(I->getContext()))
+			return NULL;
+		*bit = 0;
+		return TI->getOperand(0);
+	}
+
+	ICmpInst *CI = dyn_cast<ICmpInst>(I);
+	if (CI == NULL || !CI->isEquality())
+		return NULL;
+	ConstantInt *zero = dyn_cast<ConstantInt>(CI->getOperand(1));
+	BinaryOperator *BO = dyn_cast<BinaryOperator>(CI->getOperand(0));
+	if (zero == NULL || !zero->isZero() || BO == NULL || BO->getOpcode() != Instruction::And)
+		return NULL;
+	ConstantInt *mask = dyn_cast<ConstantInt>(BO->getOperand(1));
+	if (mask == NULL || !mask->getValue().isPowerOf2())
+		return NULL;
+	*bit = mask->getValue().logBase2();
+	*inverted = CI->getPredicate() == ICmpInst::ICMP_EQ;
+	return BO->getOperand(0);
+}
+
+bool
+FlagBitFolding::runOnFunction(Function &F)
+{
+	size_t before = count_instructions(F);
+	bool changed = false;
+
+	for (Function::iterator bb = F.begin(); bb != F.end(); bb++) {
+		for (BasicBlock::iterator it = bb->begin(); it != bb->end(); ) {
+			Instruction *I = it++;
+			unsigned bit;
+			bool inverted;
+
+			Value *v = get_tested_bit(I, &bit, &inverted);
+			if (v == NULL)
+				continue;
+			unsigned budget = BIT_BUDGET;
+			bool inv;
+			Value *b = get_bit(v, bit, &inv, &budget);
+			if (b == NULL)
+				continue;
+			if (inverted != inv) {
+				if (ConstantInt *c = dyn_cast<ConstantInt>(b))
+					b = ConstantInt::get(I->getContext(), ~c->getValue());
+				else
+					b = BinaryOperator::CreateNot(b, "", I);
+			}
+			replace_instruction(I, b);
+			changed = true;
+		}
+	}
+
+	if (changed)
+		LOG("(flag bits: %zu -> %zu) ", before, count_instructions(F));
+	return changed;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+FunctionPass *
+createRegisterStoreEliminationPass()
+{
+	return new RegisterStoreElimination();
+}
+
+FunctionPass *
+createSwapEliminationPass()
+{
+	return new SwapElimination();
+}
+
+FunctionPass *
+createFlagBitFoldingPass()
+{
+	return new FlagBitFolding();
+}
@@ -0,0 +1,3 @@
+FunctionPass *createRegisterStoreEliminationPass();
+FunctionPass *createSwapEliminationPass();
+FunctionPass *createFlagBitFoldingPass();
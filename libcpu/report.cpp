@@ -0,0 +1,276 @@
+/*
+ * libcpu: report.cpp
+ *
+ * Translation quality report. With CPU_DEBUG_REPORT, this
+ * collects the number of guest instructions, LLVM instructions
+ * (before and after optimization) and emitted host bytes for
+ * every translated basic block and every guest mnemonic, and
+ * prints the worst-expanding ones.
+ */
+
+#include <vector>
+#include <algorithm>
+
+#include "llvm/BasicBlock.h"
+#include "llvm/Function.h"
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/ExecutionEngine/JITEventListener.h"
+
+#include "libcpu.h"
+#include "basicblock.h"
+#include "report.h"
+
+#define REPORT_LINES 20
+
+//////////////////////////////////////////////////////////////////////
+// collecting
+//////////////////////////////////////////////////////////////////////
+
+/*
+ * find the guest basic block an LLVM basic block belongs to,
+ * using the label created by create_basicblock(). Returns false
+ * for the helper blocks (entry, dispatch, ret, trap) and for
+ * external ('E') blocks.
+ */
+static bool
+report_owner(cpu_t *cpu, BasicBlock *bb, addr_t *owner)
+{
+	std::string name = bb->getNameStr();
+	unsigned long long addr;
+	char type;
+
+	if (name.length() < 9 || sscanf(name.c_str(), "%c%llx", &type, &addr) != 2)
+		return false;
+
+	switch (type) {
+		case BB_TYPE_NORMAL:
+			*owner = (addr_t)addr;
+			return true;
+		case BB_TYPE_COND:
+		case BB_TYPE_DELAY:
+		case BB_TYPE_BODY:
+		case BB_TYPE_EXIT:
+		case BB_TYPE_TRAP:
+		case BB_TYPE_LOOP: {
+			/* internal block: belongs to the block containing the instruction */
+			report_block_map::iterator it = cpu->report_block.upper_bound((addr_t)addr);
+			if (it == cpu->report_block.begin())
+				return false;
+			*owner = (--it)->first;
+			return true;
+		}
+		default:
+			return false;
+	}
+}
+
+report_mark_t
+report_instr_start(cpu_t *cpu, BasicBlock *cur_bb)
+{
+	report_mark_t mark;
+
+	mark.cur_bb = cur_bb;
+	mark.cur_size = cur_bb->size();
+	mark.last_bb = &cpu->cur_func->back();
+	return mark;
+}
+
+void
+report_instr_done(cpu_t *cpu, addr_t pc, addr_t bb_pc, report_mark_t *mark)
+{
+	char line[80];
+	size_t ir;
+
+	/* instructions appended to the current block, plus all blocks
+	 * translate_instr() created for this instruction */
+	ir = mark->cur_bb->size() - mark->cur_size;
+	Function::iterator it = mark->last_bb;
+	for (it++; it != cpu->cur_func->end(); it++)
+		ir += it->size();
+
+	/* the mnemonic is the first word of the disassembly */
+	line[0] = '\0';
+	cpu->f.disasm_instr(cpu, pc, line, sizeof(line));
+	std::string mnemonic(line, strcspn(line, " \t"));
+	if (mnemonic.empty())
+		mnemonic = "???";
+
+	report_entry_t &op = cpu->report_opcode[mnemonic];
+	op.guest_instrs++;
+	op.ir_before += ir;
+
+	cpu->report_block[bb_pc].guest_instrs++;
+	cpu->report_total.guest_instrs++;
+}
+
+static void
+count_function_ir(cpu_t *cpu, Function *f, bool optimized)
+{
+	Function::iterator it;
+	addr_t owner;
+
+	for (it = f->begin(); it != f->end(); it++) {
+		uint64_t size = it->size();
+		report_entry_t *e = NULL;
+
+		if (report_owner(cpu, it, &owner))
+			e = &cpu->report_block[owner];
+		if (optimized) {
+			cpu->report_total.ir_after += size;
+			if (e != NULL)
+				e->ir_after += size;
+		} else {
+			cpu->report_total.ir_before += size;
+			if (e != NULL)
+				e->ir_before += size;
+		}
+	}
+}
+
+/* counts jitmain() and its subroutines */
+void
+report_count_ir(cpu_t *cpu, bool optimized)
+{
+	count_function_ir(cpu, cpu->cur_func, optimized);
+	for (subfunc_map::const_iterator s = cpu->sub_func.begin(); s != cpu->sub_func.end(); s++)
+		count_function_ir(cpu, s->second, optimized);
+}
+
+/*
+ * The JIT only tells us the size of the whole function, so the
+ * host bytes are split across the guest blocks according to
+ * their share of the optimized IR.
+ */
+static void
+report_host_bytes(cpu_t *cpu, const Function &f, size_t bytes)
+{
+	Function::const_iterator it;
+	uint64_t ir_total = 0;
+	addr_t owner;
+
+	cpu->report_total.host_bytes += bytes;
+
+	for (it = f.begin(); it != f.end(); it++)
+		ir_total += it->size();
+	if (ir_total == 0)
+		return;
+
+	for (it = f.begin(); it != f.end(); it++)
+		if (report_owner(cpu, const_cast<BasicBlock *>(&*it), &owner))
+			cpu->report_block[owner].host_bytes += bytes * it->size() / ir_total;
+}
+
+class ReportListener : public JITEventListener {
+	cpu_t *cpu;
+public:
+	ReportListener(cpu_t *c) : cpu(c) {}
+
+	virtual void NotifyFunctionEmitted(const Function &F, void *Code,
+			size_t Size, const EmittedFunctionDetails &Details) {
+		if (REPORTING)
+			report_host_bytes(cpu, F, Size);
+	}
+};
+
+void
+report_init(cpu_t *cpu)
+{
+	memset(&cpu->report_total, 0, sizeof(cpu->report_total));
+	cpu->report_listener = new ReportListener(cpu);
+	cpu->exec_engine->RegisterJITEventListener(cpu->report_listener);
+}
+
+void
+report_done(cpu_t *cpu)
+{
+	if (cpu->report_listener == NULL)
+		return;
+	cpu->exec_engine->UnregisterJITEventListener(cpu->report_listener);
+	delete cpu->report_listener;
+	cpu->report_listener = NULL;
+}
+
+//////////////////////////////////////////////////////////////////////
+// printing
+//////////////////////////////////////////////////////////////////////
+
+static double
+ratio(uint64_t a, uint64_t b)
+{
+	return b ? (double)a / b : 0.0;
+}
+
+/* worst expansion first: host bytes, then optimized IR per guest instruction */
+template<typename T>
+static bool
+worse(const T &a, const T &b)
+{
+	double ha = ratio(a.second.host_bytes, a.second.guest_instrs);
+	double hb = ratio(b.second.host_bytes, b.second.guest_instrs);
+	if (ha != hb)
+		return ha > hb;
+	return ratio(a.second.ir_after, a.second.guest_instrs) >
+		ratio(b.second.ir_after, b.second.guest_instrs);
+}
+
+static bool
+worse_opcode(const std::pair<std::string, report_entry_t> &a,
+	const std::pair<std::string, report_entry_t> &b)
+{
+	return ratio(a.second.ir_before, a.second.guest_instrs) >
+		ratio(b.second.ir_before, b.second.guest_instrs);
+}
+
+void
+cpu_print_translation_report(cpu_t *cpu)
+{
+	report_entry_t &t = cpu->report_total;
+	size_t i;
+
+	printf("translation report for %s", cpu->info.name);
+	if (cpu->info.full_name != NULL)
+		printf(" (%s)", cpu->info.full_name);
+	printf("\n");
+	if (!REPORTING) {
+		printf("  no data: CPU_DEBUG_REPORT not set\n");
+		return;
+	}
+	printf("  guest instrs %llu, IR %llu -> %llu, host bytes %llu\n",
+		(unsigned long long)t.guest_instrs, (unsigned long long)t.ir_before,
+		(unsigned long long)t.ir_after, (unsigned long long)t.host_bytes);
+	printf("  per guest instr: IR %.2f -> %.2f, host bytes %.2f\n",
+		ratio(t.ir_before, t.guest_instrs), ratio(t.ir_after, t.guest_instrs),
+		ratio(t.host_bytes, t.guest_instrs));
+
+	std::vector<std::pair<addr_t, report_entry_t> > blocks;
+	report_block_map::const_iterator bi;
+	for (bi = cpu->report_block.begin(); bi != cpu->report_block.end(); bi++)
+		if (bi->second.guest_instrs != 0)
+			blocks.push_back(*bi);
+	std::sort(blocks.begin(), blocks.end(), worse<std::pair<addr_t, report_entry_t> >);
+
+	printf("\nworst blocks (of %u):\n", (unsigned)blocks.size());
+	printf("  %-10s %6s %8s %8s %8s %8s %8s\n",
+		"block", "instrs", "IR", "IR-opt", "host", "IR/i", "host/i");
+	for (i = 0; i < blocks.size() && i < REPORT_LINES; i++) {
+		report_entry_t &e = blocks[i].second;
+		printf("  L%08llx  %6llu %8llu %8llu %8llu %8.2f %8.2f\n",
+			(unsigned long long)blocks[i].first,
+			(unsigned long long)e.guest_instrs, (unsigned long long)e.ir_before,
+			(unsigned long long)e.ir_after, (unsigned long long)e.host_bytes,
+			ratio(e.ir_after, e.guest_instrs), ratio(e.host_bytes, e.guest_instrs));
+	}
+
+	std::vector<std::pair<std::string, report_entry_t> > ops(
+		cpu->report_opcode.begin(), cpu->report_opcode.end());
+	std::sort(ops.begin(), ops.end(), worse_opcode);
+
+	printf("\nworst opcodes (of %u, unoptimized IR):\n", (unsigned)ops.size());
+	printf("  %-10s %6s %8s %8s\n", "opcode", "count", "IR", "IR/i");
+	for (i = 0; i < ops.size() && i < REPORT_LINES; i++) {
+		report_entry_t &e = ops[i].second;
+		printf("  %-10s %6llu %8llu %8.2f\n", ops[i].first.c_str(),
+			(unsigned long long)e.guest_instrs, (unsigned long long)e.ir_before,
+			ratio(e.ir_before, e.guest_instrs));
+	}
+}
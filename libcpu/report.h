@@ -0,0 +1,13 @@
+#define REPORTING (cpu->flags_debug & CPU_DEBUG_REPORT)
+
+typedef struct report_mark {
+	BasicBlock *cur_bb;
+	size_t cur_size;
+	BasicBlock *last_bb;
+} report_mark_t;
+
+void report_init(cpu_t *cpu);
+void report_done(cpu_t *cpu);
+report_mark_t report_instr_start(cpu_t *cpu, BasicBlock *cur_bb);
+void report_instr_done(cpu_t *cpu, addr_t pc, addr_t bb_pc, report_mark_t *mark);
+void report_count_ir(cpu_t *cpu, bool optimized);
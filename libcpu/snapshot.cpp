@@ -0,0 +1,281 @@
+/*
+ * libcpu: snapshot.cpp
+ *
+ * Snapshots of guest RAM and the register files, for resetting
+ * a guest many times (fuzzing, test replay, checkpoints).
+ *
+ * After a snapshot has been taken or restored, guest RAM is write
+ * protected; the first write to a page faults, and the fault handler
+ * records the page as dirty and makes it writable again. Restoring
+ * the same snapshot then only copies back the dirty pages.
+ * Writes done by the host kernel (e.g. read(2) into guest RAM)
+ * fail with EFAULT instead of being tracked, so clients that do
+ * system calls on guest memory must not enable snapshots.
+ *
+ * Tags and translated code are not touched; the PC is part of the
+ * GPR file.
+ */
+
+#include "libcpu.h"
+#include "snapshot.h"
+#include "lock.h"
+
+#if HAVE_MPROTECT && HAVE_SIGACTION
+#define SNAPSHOT_TRACK_DIRTY 1
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+struct cpu_snapshot {
+	uint8_t *RAM;	/* where the copy was taken from */
+	uint8_t *ram;
+	size_t ram_size;
+	uint8_t *grf;
+	uint8_t *frf;
+};
+
+#ifdef SNAPSHOT_TRACK_DIRTY
+
+#define MAX_REGIONS 16
+
+/* protected area of one cpu: the whole pages of its RAM. Partial
+ * pages at the edges are shared with other host data, so they are
+ * not protected but copied back on every restore. */
+typedef struct {
+	cpu_t *cpu;
+	uint8_t *start;
+	uint8_t *end;
+	size_t pages;
+	uint8_t *dirty;				/* one byte per page */
+	size_t *dirty_list;			/* dirty page numbers */
+	volatile size_t dirty_count;
+} snapshot_region_t;
+
+static snapshot_region_t regions[MAX_REGIONS];
+static struct sigaction old_segv, old_bus;
+static bool handler_installed = false;
+static size_t page_size;
+
+static void
+snapshot_chain(int sig, siginfo_t *si, void *ctx)
+{
+	struct sigaction *old = (sig == SIGBUS) ? &old_bus : &old_segv;
+
+	if (old->sa_flags & SA_SIGINFO)
+		old->sa_sigaction(sig, si, ctx);
+	else if (old->sa_handler == SIG_DFL || old->sa_handler == SIG_IGN) {
+		/* refault with the default action */
+		sigaction(sig, old, NULL);
+	} else
+		old->sa_handler(sig);
+}
+
+static void
+snapshot_fault(int sig, siginfo_t *si, void *ctx)
+{
+	uint8_t *addr = (uint8_t *)si->si_addr;
+
+	for (int i = 0; i < MAX_REGIONS; i++) {
+		snapshot_region_t *r = &regions[i];
+		if (r->cpu == NULL || addr < r->start || addr >= r->end)
+			continue;
+
+		/* other threads may fault on the same page; only the first
+		 * one to claim it adds it to the list */
+		size_t page = (addr - r->start) / page_size;
+		if (__sync_lock_test_and_set(&r->dirty[page], 1) == 0)
+			r->dirty_list[__sync_fetch_and_add(&r->dirty_count, 1)] = page;
+		mprotect(r->start + page * page_size, page_size, PROT_READ | PROT_WRITE);
+		return;
+	}
+
+	snapshot_chain(sig, si, ctx);
+}
+
+static void
+snapshot_install_handler()
+{
+	struct sigaction sa;
+
+	if (handler_installed)
+		return;
+
+	page_size = sysconf(_SC_PAGESIZE);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = snapshot_fault;
+	sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGSEGV, &sa, &old_segv);
+	sigaction(SIGBUS, &sa, &old_bus);
+	handler_installed = true;
+}
+
+static snapshot_region_t *
+snapshot_region(cpu_t *cpu)
+{
+	for (int i = 0; i < MAX_REGIONS; i++)
+		if (regions[i].cpu == cpu)
+			return &regions[i];
+	return NULL;
+}
+
+/* (re)start dirty tracking of RAM, with all pages clean */
+static void
+snapshot_track(cpu_t *cpu, size_t ram_size)
+{
+	snapshot_region_t *r;
+
+	/* the region table is shared by all cpus */
+	libcpu_lock();
+	snapshot_install_handler();
+
+	uint8_t *start = (uint8_t *)(((uintptr_t)cpu->RAM + page_size - 1) & ~(page_size - 1));
+	uint8_t *end = (uint8_t *)(((uintptr_t)cpu->RAM + ram_size) & ~(page_size - 1));
+	if (end < start)
+		start = end = cpu->RAM + ram_size;	/* no whole page */
+
+	r = snapshot_region(cpu);
+	if (r != NULL && (r->start != start || r->end != end)) {
+		snapshot_untrack(cpu);	/* RAM has moved or changed size */
+		r = NULL;
+	}
+
+	if (r == NULL) {
+		r = snapshot_region(NULL);
+		if (r == NULL) {
+			printf("%s: too many cpus with snapshots!\n", __func__);
+			exit(1);
+		}
+		r->start = start;
+		r->end = end;
+		r->pages = (end - start) / page_size;
+		r->dirty = (uint8_t *)calloc(r->pages, 1);
+		r->dirty_list = (size_t *)calloc(r->pages, sizeof(size_t));
+		assert(r->pages == 0 || (r->dirty != NULL && r->dirty_list != NULL));
+		r->cpu = cpu;
+	} else
+		memset(r->dirty, 0, r->pages);
+	r->dirty_count = 0;
+	libcpu_unlock();
+
+	mprotect(r->start, r->end - r->start, PROT_READ);
+}
+
+/* copy back the dirty pages of RAM and clean them */
+static void
+snapshot_restore_dirty(cpu_t *cpu, cpu_snapshot_t *snapshot)
+{
+	snapshot_region_t *r = snapshot_region(cpu);
+	uint8_t *ram_end = snapshot->RAM + snapshot->ram_size;
+
+	/* the unprotected edges */
+	memcpy(snapshot->RAM, snapshot->ram, r->start - snapshot->RAM);
+	memcpy(r->end, snapshot->ram + (r->end - snapshot->RAM), ram_end - r->end);
+
+	for (size_t i = 0; i < r->dirty_count; i++) {
+		size_t page = r->dirty_list[i];
+		uint8_t *start = r->start + page * page_size;
+
+		memcpy(start, snapshot->ram + (start - snapshot->RAM), page_size);
+		mprotect(start, page_size, PROT_READ);
+		r->dirty[page] = 0;
+	}
+	r->dirty_count = 0;
+}
+
+void
+snapshot_untrack(cpu_t *cpu)
+{
+	libcpu_lock();
+	snapshot_region_t *r = snapshot_region(cpu);
+
+	cpu->snapshot = NULL;
+	if (r != NULL) {
+		mprotect(r->start, r->end - r->start, PROT_READ | PROT_WRITE);
+		free(r->dirty_list);
+		free(r->dirty);
+		r->cpu = NULL;
+	}
+	libcpu_unlock();
+}
+
+#else /* !SNAPSHOT_TRACK_DIRTY */
+
+/* no dirty page tracking, restore always copies all of RAM */
+
+void
+snapshot_untrack(cpu_t *cpu)
+{
+	cpu->snapshot = NULL;
+}
+
+#endif /* SNAPSHOT_TRACK_DIRTY */
+
+//////////////////////////////////////////////////////////////////////
+// interface
+//////////////////////////////////////////////////////////////////////
+
+cpu_snapshot_t *
+cpu_snapshot(cpu_t *cpu, size_t ram_size)
+{
+	cpu_snapshot_t *snapshot = (cpu_snapshot_t *)calloc(1, sizeof(cpu_snapshot_t));
+	assert(snapshot != NULL);
+
+	snapshot->RAM = cpu->RAM;
+	snapshot->ram_size = ram_size;
+	snapshot->ram = (uint8_t *)malloc(ram_size);
+	snapshot->grf = (uint8_t *)malloc(cpu->rf.grf_size);
+	snapshot->frf = (uint8_t *)malloc(cpu->rf.frf_size);
+	assert(snapshot->ram != NULL && snapshot->grf != NULL);
+	assert(cpu->rf.frf_size == 0 || snapshot->frf != NULL);
+	assert(cpu->rf.grf_size != 0 && "the frontend does not set grf_size");
+
+	memcpy(snapshot->ram, cpu->RAM, ram_size);
+	memcpy(snapshot->grf, cpu->rf.grf, cpu->rf.grf_size);
+	memcpy(snapshot->frf, cpu->rf.frf, cpu->rf.frf_size);
+
+	/* RAM is identical to this snapshot now */
+#ifdef SNAPSHOT_TRACK_DIRTY
+	snapshot_track(cpu, ram_size);
+#endif
+	cpu->snapshot = snapshot;
+
+	return snapshot;
+}
+
+void
+cpu_restore(cpu_t *cpu, cpu_snapshot_t *snapshot)
+{
+	assert(snapshot->RAM == cpu->RAM && "cpu_restore(): RAM has moved");
+
+#ifdef SNAPSHOT_TRACK_DIRTY
+	if (cpu->snapshot == snapshot) {
+		snapshot_restore_dirty(cpu, snapshot);
+	} else {
+		snapshot_untrack(cpu);
+		memcpy(cpu->RAM, snapshot->ram, snapshot->ram_size);
+		snapshot_track(cpu, snapshot->ram_size);
+		cpu->snapshot = snapshot;
+	}
+#else
+	memcpy(cpu->RAM, snapshot->ram, snapshot->ram_size);
+	cpu->snapshot = snapshot;
+#endif
+
+	memcpy(cpu->rf.grf, snapshot->grf, cpu->rf.grf_size);
+	memcpy(cpu->rf.frf, snapshot->frf, cpu->rf.frf_size);
+}
+
+void
+cpu_snapshot_free(cpu_t *cpu, cpu_snapshot_t *snapshot)
+{
+	if (cpu->snapshot == snapshot)
+		snapshot_untrack(cpu);
+
+	free(snapshot->frf);
+	free(snapshot->grf);
+	free(snapshot->ram);
+	free(snapshot);
+}
@@ -0,0 +1 @@
+void snapshot_untrack(cpu_t *cpu);
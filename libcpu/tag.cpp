@@ -7,9 +7,12 @@
  * (conditional, ...) and code flow information (branch
  * target, ...)
  */
+#include <algorithm>
+
 #include "libcpu.h"
 #include "tag.h"
 #include "sha1.h"
+#include "hook.h"
 
 /*
  * TODO: on architectures with constant instruction sizes,
@@ -113,6 +116,40 @@ is_code(cpu_t *cpu, addr_t a)
 
 extern void disasm_instr(cpu_t *cpu, addr_t pc);
 
+static void tag_recursive(cpu_t *cpu, addr_t pc, int level);
+
+/*
+ * An indirect branch that the frontend recognizes as a jump through
+ * a table: all targets of the table are code. Targets outside the
+ * code area are left to the dispatcher.
+ */
+static void
+tag_jump_table(cpu_t *cpu, addr_t pc, int level)
+{
+	std::vector<addr_t> targets(JUMP_TABLE_MAX);
+	int n;
+
+	if (cpu->f.jump_table == NULL)
+		return;
+	n = cpu->f.jump_table(cpu, pc, &targets[0], JUMP_TABLE_MAX);
+	if (n <= 0)
+		return;
+
+	std::vector<addr_t> &table = cpu->jump_tables[pc];
+	table.clear();
+	for (int i = 0; i < n; i++) {
+		if (!is_inside_code_area(cpu, targets[i]) ||
+			std::find(table.begin(), table.end(), targets[i]) != table.end())
+			continue;
+		table.push_back(targets[i]);
+		or_tag(cpu, targets[i], TAG_BRANCH_TARGET);
+	}
+	LOG("jump table at $%llx: %zu targets\n", (unsigned long long)pc, table.size());
+
+	for (size_t i = 0; i < table.size(); i++)
+		tag_recursive(cpu, table[i], level+1);
+}
+
 static void
 tag_recursive(cpu_t *cpu, addr_t pc, int level)
 {
@@ -127,6 +164,8 @@ tag_recursive(cpu_t *cpu, addr_t pc, int level)
 	for(;;) {
 		if (!is_inside_code_area(cpu, pc))
 			return;
+		if (is_hooked(cpu, pc))	/* replaced by a host function */
+			return;
 		if (is_code(cpu, pc))	/* we have already been here, ignore */
 			return;
 
@@ -175,7 +214,11 @@ tag_recursive(cpu_t *cpu, addr_t pc, int level)
 		}
 
 		if (tag & TAG_BRANCH) {
+			if (new_pc == NEW_PC_NONE)
+				tag_jump_table(cpu, pc, level);
 			or_tag(cpu, new_pc, TAG_BRANCH_TARGET);
+			if (new_pc <= pc)
+				or_tag(cpu, new_pc, TAG_LOOP_HEADER);
 			tag_recursive(cpu, new_pc, level+1);
 			if (!(tag & TAG_CONDITIONAL))
 				return;
@@ -22,6 +22,7 @@
 #define TAG_ENTRY		(1<<12)	/* the client wants to be able to start execution at this instruction */
 #define TAG_AFTER_TRAP	(1<<13)	/* execution continues here after a trap reenters translation unit */
 #define TAG_TRANSLATED	(1<<14)	/* this entry/target has already been translated */
+#define TAG_LOOP_HEADER	(1<<15)	/* target of a backward jump/branch */
 
 #define TAG_UNKNOWN      0	/* unused (or not yet discovered) code or data */
 
@@ -41,3 +42,5 @@ void tag_start(cpu_t *cpu, addr_t pc);
  */
 #define NEW_PC_NONE (addr_t)-1
 
+/* most entries of a jump table, see fp_jump_table */
+#define JUMP_TABLE_MAX 1024
@@ -6,11 +6,123 @@
  * create internal basic blocks if necessary.
  */
 
+#include <assert.h>
+
 #include "llvm/Instructions.h"
 
 #include "libcpu.h"
+#include "libcpu_llvm.h"
+#include "frontend.h"
 #include "tag.h"
 #include "basicblock.h"
+#include "disasm.h"
+#include "hook.h"
+#include "report.h"
+
+/*
+ * guest cycles of the instruction at pc, including its delay slot;
+ * *taken is what it costs more if its condition holds
+ */
+int
+instr_cycles(cpu_t *cpu, addr_t pc, tag_t tag, int *taken)
+{
+	int cycles = 1, dummy;
+	tag_t dummy1;
+	addr_t new_pc, next_pc;
+
+	*taken = 0;
+	if (cpu->f.cycles != NULL)
+		cycles = cpu->f.cycles(cpu, pc, taken);
+	if (tag & TAG_DELAY_SLOT) {
+		pc += cpu->f.tag_instr(cpu, pc, &dummy1, &new_pc, &next_pc);
+		cycles += cpu->f.cycles != NULL ? cpu->f.cycles(cpu, pc, &dummy) : 1;
+	}
+	return cycles;
+}
+
+/* most instructions an idiom can span, see translate_fused() */
+#define FUSE_MAX_INSTRS 16
+
+/*
+ * the end of the instructions from pc an idiom can span: ones that
+ * continue, up to the next basic block. A conditional instruction
+ * starts a basic block after it, but one that can only be entered
+ * from the conditional instruction, so it does not end the span;
+ * with CPU_CODEGEN_COVERAGE it does, as it counts the edge.
+ */
+static addr_t
+fuse_end(cpu_t *cpu, addr_t pc)
+{
+	tag_t tag, dummy1;
+	addr_t new_pc, next_pc;
+
+	for (int i = 0; i < FUSE_MAX_INSTRS; i++) {
+		tag = get_tag(cpu, pc);
+		if (!(tag & TAG_CONTINUE) ||
+			(tag & (TAG_CALL | TAG_RET | TAG_BRANCH | TAG_TRAP | TAG_DELAY_SLOT)))
+			break;
+		cpu->f.tag_instr(cpu, pc, &dummy1, &new_pc, &next_pc);
+		pc = next_pc;
+
+		tag = get_tag(cpu, pc);
+		if (!is_code(cpu, pc) || is_hooked(cpu, pc))
+			break;
+		if (is_start_of_basicblock(cpu, pc) &&
+			((tag & (TAG_BRANCH_TARGET | TAG_SUBROUTINE | TAG_AFTER_CALL |
+				TAG_AFTER_TRAP | TAG_ENTRY)) ||
+			(cpu->flags_codegen & CPU_CODEGEN_COVERAGE)))
+			break;
+	}
+	return pc;
+}
+
+/*
+ * lets the frontend translate an idiom, a sequence of instructions
+ * at pc, as a whole; returns its length in bytes, or 0 if there is
+ * none at pc. *cur_bb is set to the basic block where code execution
+ * continues, and the instructions and cycles of the idiom are added
+ * to *instrs and *cycles (without the extra cycles of conditions),
+ * and *last_tag is set to the tag of its last instruction.
+ * bb_pc is the basic block being translated, for the report.
+ */
+int
+translate_fused(cpu_t *cpu, addr_t pc, addr_t bb_pc, BasicBlock **cur_bb,
+	uint32_t *instrs, uint64_t *cycles, tag_t *last_tag)
+{
+	tag_t tag = 0, dummy1;
+	addr_t new_pc, next_pc;
+	int len, taken;
+	report_mark_t mark = { NULL, 0, NULL };
+
+	if (cpu->f.translate_fused == NULL || !(cpu->flags_codegen & CPU_CODEGEN_FUSE))
+		return 0;
+
+	addr_t end = fuse_end(cpu, pc);
+	if (end == pc)
+		return 0;
+	if (REPORTING)
+		mark = report_instr_start(cpu, *cur_bb);
+	len = cpu->f.translate_fused(cpu, pc, end, cur_bb);
+	if (len == 0)
+		return 0;
+	assert(pc + len <= end && "translate_fused() went past the end");
+
+	LOG("fused: L%08llx-L%08llx\n", (unsigned long long)pc,
+		(unsigned long long)(pc + len));
+	for (addr_t a = pc; a < pc + len; a = next_pc) {
+		if (LOGGING && a != pc)
+			disasm_instr(cpu, a);
+		tag = get_tag(cpu, a);
+		cpu->f.tag_instr(cpu, a, &dummy1, &new_pc, &next_pc);
+		*cycles += instr_cycles(cpu, a, tag, &taken);
+		(*instrs)++;
+	}
+	*last_tag = tag;
+	if (REPORTING)
+		report_instr_done(cpu, pc, bb_pc, &mark);
+	return len;
+}
+
 /*
  * returns the basic block where code execution continues, or
  * NULL if the instruction always branches away
@@ -25,10 +137,16 @@ translate_instr(cpu_t *cpu, addr_t pc, tag_t tag,
 {
 	BasicBlock *bb_cond = NULL;
 	BasicBlock *bb_delay = NULL;
+	int taken;
 
 	/* create internal basic blocks if needed */
-	if (tag & TAG_CONDITIONAL)
+	if (tag & TAG_CONDITIONAL) {
 		bb_cond = create_basicblock(cpu, pc, cpu->cur_func, BB_TYPE_COND);
+		/* the extra cycles of a taken branch */
+		instr_cycles(cpu, pc, tag, &taken);
+		if (taken != 0)
+			arch_add_cycles(cpu, ConstantInt::get(getIntegerType(64), taken), bb_cond);
+	}
 	if ((tag & TAG_DELAY_SLOT) && (tag & TAG_CONDITIONAL))
 		bb_delay = create_basicblock(cpu, pc, cpu->cur_func, BB_TYPE_DELAY);
 
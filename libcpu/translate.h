@@ -1 +1,3 @@
+int instr_cycles(cpu_t *cpu, addr_t pc, tag_t tag, int *taken);
+int translate_fused(cpu_t *cpu, addr_t pc, addr_t bb_pc, BasicBlock **cur_bb, uint32_t *instrs, uint64_t *cycles, tag_t *last_tag);
 BasicBlock *translate_instr(cpu_t *cpu, addr_t pc, tag_t tag, BasicBlock *bb_target, BasicBlock *bb_trap, BasicBlock *bb_next, BasicBlock *cur_bb);
@@ -5,16 +5,565 @@
  * filling them with instructions.
  */
 
+#include <set>
+#include <vector>
+
 #include "llvm/BasicBlock.h"
+#include "llvm/Constants.h"
 #include "llvm/Instructions.h"
 
 #include "libcpu.h"
 #include "libcpu_llvm.h"
 #include "basicblock.h"
+#include "coverage.h"
 #include "disasm.h"
+#include "function.h"
+#include "hook.h"
+#include "report.h"
 #include "tag.h"
 #include "translate.h"
+#include "trap.h"
+
+#define BLOCK_ENTRY_CHECKS (CPU_CODEGEN_BUDGET | CPU_CODEGEN_INTERRUPTS | CPU_CODEGEN_CYCLES)
+
+/*
+ * emit the checks at the entry of a basic block; if the block
+ * may run, control continues in bb_body, otherwise the function
+ * returns before the block is executed.
+ * All checks share a single branch.
+ */
+static void
+emit_block_entry(cpu_t *cpu, addr_t pc, uint32_t instrs, uint64_t cycles,
+	BasicBlock *bb, BasicBlock *bb_body, BasicBlock *bb_ret)
+{
+	Type const *ty = getIntegerType(64);
+	Value *budget = NULL, *no_irq = NULL, *run = NULL, *old_cycles = NULL;
+	Value *exit_code;
+
+	// cycles += cycles of the block
+	if (cpu->flags_codegen & CPU_CODEGEN_CYCLES) {
+		old_cycles = new LoadInst(cpu->ptr_cycles, "", false, bb);
+		new StoreInst(BinaryOperator::Create(Instruction::Add, old_cycles,
+			ConstantInt::get(ty, cycles), "", bb), cpu->ptr_cycles, bb);
+	}
+
+	// budget -= instrs; run if old budget > 0
+	if (cpu->flags_codegen & CPU_CODEGEN_BUDGET) {
+		budget = new LoadInst(cpu->ptr_budget, "", false, bb);
+		new StoreInst(BinaryOperator::Create(Instruction::Sub, budget,
+			ConstantInt::get(ty, instrs), "", bb), cpu->ptr_budget, bb);
+		run = new ICmpInst(*bb, ICmpInst::ICMP_SGT, budget, ConstantInt::get(ty, 0), "");
+	}
+
+	// run if no interrupt is pending
+	if (cpu->flags_codegen & CPU_CODEGEN_INTERRUPTS) {
+		Value *pending = new LoadInst(cpu->ptr_interrupt_pending, "", true, bb);
+		no_irq = new ICmpInst(*bb, ICmpInst::ICMP_EQ, pending, ConstantInt::get(getIntegerType(32), 0), "");
+		run = run ? BinaryOperator::Create(Instruction::And, run, no_irq, "", bb) : no_irq;
+	}
+
+	if (run == NULL) {
+		BranchInst::Create(bb_body, bb);
+		return;
+	}
+
+	BasicBlock *bb_exit = create_basicblock(cpu, pc, cpu->cur_func, BB_TYPE_EXIT);
+
+	// the block does not run, so it is not charged
+	if (budget != NULL)
+		new StoreInst(budget, cpu->ptr_budget, bb_exit);
+	if (old_cycles != NULL)
+		new StoreInst(old_cycles, cpu->ptr_cycles, bb_exit);
+
+	if (no_irq == NULL)
+		exit_code = ConstantInt::get(XgetType(Int32Ty), JIT_RETURN_BUDGET);
+	else if (budget == NULL)
+		exit_code = ConstantInt::get(XgetType(Int32Ty), JIT_RETURN_INTERRUPT);
+	else
+		exit_code = SelectInst::Create(no_irq,
+			ConstantInt::get(XgetType(Int32Ty), JIT_RETURN_BUDGET),
+			ConstantInt::get(XgetType(Int32Ty), JIT_RETURN_INTERRUPT), "", bb_exit);
+	emit_store_pc_exit(cpu, bb_exit, pc, exit_code, bb_ret);
+
+	BranchInst::Create(bb_body, bb_exit, run, bb);
+}
+
+/*
+ * A natural loop. Every block can be entered from the dispatcher,
+ * so LLVM would not see a loop there. The blocks of the loop are
+ * therefore translated a second time, into a copy that can only be
+ * entered through its header; the original header just jumps to
+ * the copy. Other entries into the loop (returns, traps, resuming
+ * after the block entry checks) run the original blocks up to the
+ * header.
+ */
+typedef struct {
+	addr_t start;		/* header */
+	addr_t end;			/* after the last backward branch */
+	bbaddr_map bbs;		/* copies of the blocks in [start, end) */
+} loop_t;
+
+typedef std::map<addr_t, loop_t> loop_map;
+
+/* the outermost loops whose blocks are all translated now */
+static void
+find_loops(cpu_t *cpu, bbaddr_map &bb_addr, loop_map &loops)
+{
+	std::map<addr_t, addr_t> ends;
+	addr_t pc, last_end = 0;
+
+	for (pc = cpu->code_start; pc < cpu->code_end; pc++) {
+		tag_t tag = get_tag(cpu, pc), dummy1;
+		addr_t new_pc, next_pc;
+
+		if (!(tag & TAG_CODE) || !(tag & TAG_BRANCH))
+			continue;
+		cpu->f.tag_instr(cpu, pc, &dummy1, &new_pc, &next_pc);
+		if (new_pc > pc || !(get_tag(cpu, new_pc) & TAG_LOOP_HEADER))
+			continue;
+		if (ends[new_pc] < next_pc)
+			ends[new_pc] = next_pc;
+	}
+
+	for (std::map<addr_t, addr_t>::const_iterator it = ends.begin(); it != ends.end(); it++) {
+		/* nested loops are part of the copy; skip overlapping ones */
+		if (it->first < last_end)
+			continue;
+
+		bool complete = bb_addr.find(it->first) != bb_addr.end() &&
+			!is_hooked(cpu, it->first);
+		for (pc = it->first; complete && pc < it->second; pc++)
+			if (is_start_of_basicblock(cpu, pc) && bb_addr.find(pc) == bb_addr.end())
+				complete = false;
+		if (!complete)
+			continue;
+
+		loop_t &loop = loops[it->first];
+		loop.start = it->first;
+		loop.end = it->second;
+		for (bbaddr_map::const_iterator b = bb_addr.lower_bound(loop.start);
+			b != bb_addr.end() && b->first < loop.end; b++) {
+			if (!is_hooked(cpu, b->first))
+				loop.bbs[b->first] = create_basicblock(cpu, b->first, cpu->cur_func, BB_TYPE_LOOP);
+		}
+		last_end = loop.end;
+		LOG("loop: L%08llx-L%08llx\n", (unsigned long long)loop.start,
+			(unsigned long long)loop.end);
+	}
+}
+
+/* branch target; inside a loop copy, blocks of the loop are in the copy */
+static BasicBlock *
+lookup_target(cpu_t *cpu, loop_t *loop, addr_t pc, BasicBlock *bb_ret)
+{
+	if (loop != NULL) {
+		bbaddr_map::const_iterator it = loop->bbs.find(pc);
+		if (it != loop->bbs.end())
+			return it->second;
+	}
+	return (BasicBlock*)lookup_basicblock(cpu, cpu->cur_func, pc, bb_ret, BB_TYPE_NORMAL);
+}
+
+/*
+ * where control leaves the blocks of the function being translated:
+ * jitmain(), or a subroutine (see translate_subroutine())
+ */
+typedef struct {
+	BasicBlock *bb_dispatch;	/* continue at the PC */
+	BasicBlock *bb_return;		/* guest return */
+	BasicBlock *bb_ret;
+	BasicBlock *bb_trap;
+	loop_t *loop;				/* loop copy being translated, or NULL */
+} func_ctx_t;
+
+/* guest recursion deeper than this continues in the caller's blocks */
+#define SUBROUTINE_MAX_DEPTH 1024
+
+/*
+ * A guest call of a subroutine that has its own function. The guest
+ * state is passed through the register files. If the subroutine
+ * returned (JIT_RETURN_NOERR) to the instruction after the call,
+ * the caller continues right there; if it left for some other PC,
+ * the caller dispatches on it; any other exit code is passed on.
+ */
+static BasicBlock *
+emit_subroutine_call(cpu_t *cpu, Function *sub, addr_t sub_pc,
+	addr_t after_pc, func_ctx_t const *ctx)
+{
+	Type const *ty = getIntegerType(32);
+	Function *f = cpu->cur_func;
+
+	BasicBlock *bb = BasicBlock::Create(_CTX(), "", f, 0);
+	BasicBlock *bb_call = BasicBlock::Create(_CTX(), "", f, 0);
+	BasicBlock *bb_deep = BasicBlock::Create(_CTX(), "", f, 0);
+	BasicBlock *bb_returned = BasicBlock::Create(_CTX(), "", f, 0);
+	BasicBlock *bb_left = BasicBlock::Create(_CTX(), "", f, 0);
+	BasicBlock *bb_exit = BasicBlock::Create(_CTX(), "", f, 0);
+
+	Value *ptr_depth = get_cpu_field_pointer(cpu, &cpu->call_depth, ty, bb);
+	Value *depth = new LoadInst(ptr_depth, "", false, bb);
+	Value *shallow = new ICmpInst(*bb, ICmpInst::ICMP_ULT, depth,
+		ConstantInt::get(ty, SUBROUTINE_MAX_DEPTH), "");
+	BranchInst::Create(bb_call, bb_deep, shallow, bb);
+
+	// too deep, run the subroutine without a host call
+	emit_store_pc_return(cpu, bb_deep, sub_pc, ctx->bb_dispatch);
+
+	new StoreInst(BinaryOperator::Create(Instruction::Add, depth,
+		ConstantInt::get(ty, 1), "", bb_call), ptr_depth, bb_call);
+	spill_reg_state(cpu, bb_call);
+	Value *args[] = { cpu->ptr_RAM, cpu->ptr_grf, cpu->ptr_frf,
+		cpu->ptr_func_debug, cpu->ptr_cpu };
+	Value *rc = CallInst::Create(sub, args, args + 5, "", bb_call);
+	new StoreInst(depth, ptr_depth, bb_call);
+	reload_reg_state(cpu, bb_call);
+	Value *returned = new ICmpInst(*bb_call, ICmpInst::ICMP_EQ, rc,
+		ConstantInt::get(ty, JIT_RETURN_NOERR), "");
+	BranchInst::Create(bb_returned, bb_left, returned, bb_call);
+
+	// verified return
+	Value *v_pc = new LoadInst(cpu->ptr_PC, "", false, bb_returned);
+	Value *same = new ICmpInst(*bb_returned, ICmpInst::ICMP_EQ, v_pc,
+		ConstantInt::get(getIntegerType(cpu->info.address_size), after_pc), "");
+	BranchInst::Create(lookup_target(cpu, ctx->loop, after_pc, ctx->bb_ret),
+		ctx->bb_dispatch, same, bb_returned);
+
+	Value *notfound = new ICmpInst(*bb_left, ICmpInst::ICMP_EQ, rc,
+		ConstantInt::get(ty, JIT_RETURN_FUNCNOTFOUND), "");
+	BranchInst::Create(ctx->bb_dispatch, bb_exit, notfound, bb_left);
+
+	new StoreInst(rc, cpu->ptr_exit_code, bb_exit);
+	BranchInst::Create(ctx->bb_ret, bb_exit);
+
+	return bb;
+}
+
+/*
+ * An indirect branch through a jump table (see tag_jump_table())
+ * continues in a switch over the targets of the table only; any
+ * other PC goes to the dispatcher.
+ */
+static BasicBlock *
+emit_jump_table(cpu_t *cpu, addr_t pc, func_ctx_t const *ctx)
+{
+	jumptable_map::const_iterator jt = cpu->jump_tables.find(pc);
+	if (jt == cpu->jump_tables.end())
+		return ctx->bb_dispatch;
+
+	std::vector<addr_t> const &targets = jt->second;
+	BasicBlock *bb = BasicBlock::Create(_CTX(), "", cpu->cur_func, 0);
+	Value *v_pc = new LoadInst(cpu->ptr_PC, "", false, bb);
+	SwitchInst *sw = SwitchInst::Create(v_pc, ctx->bb_dispatch, targets.size(), bb);
+	for (size_t i = 0; i < targets.size(); i++)
+		sw->addCase(ConstantInt::get(getIntegerType(cpu->info.address_size), targets[i]),
+			lookup_target(cpu, ctx->loop, targets[i], ctx->bb_ret));
+	return bb;
+}
+
+/*
+ * An idle loop is a basic block that branches back to its own start
+ * and does nothing but read memory and set registers, where no
+ * iteration reads what an earlier one set. Once it has branched back,
+ * it spins until someone else changes memory, e.g. a device or an
+ * interrupt handler. See CPU_CODEGEN_IDLE.
+ */
+
+/* local variables and the register files */
+static bool
+is_register_pointer(Value *ptr)
+{
+	Value *base = ptr->getUnderlyingObject();
+	if (isa<AllocaInst>(base))
+		return true;
+	Argument *arg = dyn_cast<Argument>(base);
+	return arg != NULL && (arg->getArgNo() == 1 || arg->getArgNo() == 2);
+}
+
+/*
+ * whether the code of a block, from bb_body, is an idle loop; created
+ * are the IR blocks translating it created, bb_loop is the start of
+ * the block and bb_next the not-taken target of its last branch.
+ * The IR blocks of the loop body are returned in region.
+ */
+static bool
+is_idle_loop(cpu_t *cpu, BasicBlock *bb_body, BasicBlock *bb_loop,
+	BasicBlock *bb_next, std::set<BasicBlock *> const &created,
+	std::set<BasicBlock *> &region)
+{
+	std::vector<BasicBlock *> todo;
+	bool loops = false;
+
+	// the IR blocks of the loop body; they only leave through bb_next
+	region.insert(bb_body);
+	todo.push_back(bb_body);
+	while (!todo.empty()) {
+		TerminatorInst *t = todo.back()->getTerminator();
+		todo.pop_back();
+		if (t == NULL || t->getNumSuccessors() == 0)
+			return false;
+		for (unsigned i = 0; i < t->getNumSuccessors(); i++) {
+			BasicBlock *succ = t->getSuccessor(i);
+			if (succ == bb_loop)
+				loops = true;
+			else if (succ == bb_next)
+				continue;
+			else if (created.find(succ) == created.end())
+				return false;
+			else if (region.insert(succ).second)
+				todo.push_back(succ);
+		}
+	}
+	if (!loops)
+		return false;
 
+	// stores only to registers, no calls that access memory
+	std::set<Value *> written;
+	std::set<BasicBlock *>::const_iterator bb;
+	for (bb = region.begin(); bb != region.end(); bb++) {
+		for (BasicBlock::iterator i = (*bb)->begin(); i != (*bb)->end(); i++) {
+			if (StoreInst *si = dyn_cast<StoreInst>(i)) {
+				if (si->isVolatile() || !is_register_pointer(si->getPointerOperand()))
+					return false;
+				written.insert(si->getPointerOperand());
+			} else if (CallInst *ci = dyn_cast<CallInst>(i)) {
+				Function *callee = ci->getCalledFunction();
+				if (callee == NULL || !callee->doesNotAccessMemory())
+					return false;
+			} else if (i->mayWriteToMemory())
+				return false;
+		}
+	}
+
+	// registers written are set before they are read; the counters don't matter
+	written.erase(cpu->ptr_budget);
+	written.erase(cpu->ptr_cycles);
+	for (bb = region.begin(); bb != region.end(); bb++) {
+		std::set<Value *> set_here;
+		for (BasicBlock::iterator i = (*bb)->begin(); i != (*bb)->end(); i++) {
+			if (StoreInst *si = dyn_cast<StoreInst>(i))
+				set_here.insert(si->getPointerOperand());
+			else if (LoadInst *li = dyn_cast<LoadInst>(i)) {
+				Value *ptr = li->getPointerOperand();
+				if (written.count(ptr) && !set_here.count(ptr))
+					return false;
+			}
+		}
+	}
+	return true;
+}
+
+/* leave with JIT_RETURN_IDLE instead of running the loop again */
+static void
+emit_idle_exit(cpu_t *cpu, addr_t pc, BasicBlock *bb_loop,
+	std::set<BasicBlock *> const &region, BasicBlock *bb_ret)
+{
+	BasicBlock *bb_idle = create_basicblock(cpu, pc, cpu->cur_func, BB_TYPE_IDLE);
+	emit_store_pc_exit(cpu, bb_idle, pc,
+		ConstantInt::get(getIntegerType(32), JIT_RETURN_IDLE), bb_ret);
+
+	for (std::set<BasicBlock *>::const_iterator bb = region.begin(); bb != region.end(); bb++) {
+		TerminatorInst *t = (*bb)->getTerminator();
+		for (unsigned i = 0; i < t->getNumSuccessors(); i++)
+			if (t->getSuccessor(i) == bb_loop)
+				t->setSuccessor(i, bb_idle);
+	}
+}
+
+static void
+translate_block(cpu_t *cpu, addr_t pc, BasicBlock *cur_bb, func_ctx_t const *ctx)
+{
+	loop_t *loop = ctx->loop;
+	BasicBlock *bb_dispatch = ctx->bb_dispatch;
+	BasicBlock *bb_ret = ctx->bb_ret;
+	BasicBlock *bb_trap = ctx->bb_trap;
+	addr_t bb_pc = pc;
+	BasicBlock *bb_entry = NULL;
+	uint32_t instrs = 0;
+	uint64_t cycles = 0;
+
+	tag_t tag;
+	addr_t new_pc;
+	BasicBlock *bb_target = NULL, *bb_next = NULL, *bb_cont = NULL;
+	BasicBlock *bb_last = &cpu->cur_func->back();
+
+	// Keep the 'L' block for the entry checks.
+	if (cpu->flags_codegen & BLOCK_ENTRY_CHECKS) {
+		bb_entry = cur_bb;
+		cur_bb = create_basicblock(cpu, pc, cpu->cur_func, BB_TYPE_BODY);
+	}
+	BasicBlock *bb_body = cur_bb;
+
+	if ((cpu->flags_codegen & CPU_CODEGEN_COVERAGE) && coverage_needed(cpu, pc))
+		emit_coverage(cpu, pc, cur_bb);
+
+	do {
+		tag_t dummy1;
+
+		if (LOGGING)
+			disasm_instr(cpu, pc);
+
+		tag = get_tag(cpu, pc);
+
+		/* an idiom the frontend translates as a whole; tag is then
+		 * the one of its last instruction, for the idle loop check */
+		int fused = translate_fused(cpu, pc, bb_pc, &cur_bb, &instrs, &cycles, &tag);
+		if (fused != 0) {
+			pc += fused;
+			bb_cont = cur_bb;
+			continue;
+		}
+
+		/* get address of the following instruction */
+		addr_t next_pc;
+		cpu->f.tag_instr(cpu, pc, &dummy1, &new_pc, &next_pc);
+
+		int taken;
+		cycles += instr_cycles(cpu, pc, tag, &taken);
+
+		/* get target basic block */
+		if (tag & TAG_RET)
+			bb_target = ctx->bb_return;
+		if (tag & (TAG_CALL|TAG_BRANCH)) {
+			subfunc_map::const_iterator sub = cpu->sub_func.find(new_pc);
+			if (new_pc == NEW_PC_NONE) /* translate_instr() will set PC */
+				bb_target = emit_jump_table(cpu, pc, ctx);
+			else if ((tag & TAG_CALL) && sub != cpu->sub_func.end())
+				bb_target = emit_subroutine_call(cpu, sub->second, new_pc, next_pc, ctx);
+			else
+				bb_target = lookup_target(cpu, loop, new_pc, bb_ret);
+		}
+		/* get not-taken basic block */
+		if (tag & TAG_CONDITIONAL)
+			bb_next = lookup_target(cpu, loop, next_pc, bb_ret);
+
+		/* call the trap function in place */
+		BasicBlock *bb_trap_instr = bb_trap;
+		if ((tag & TAG_TRAP) && cpu->trap_function != NULL) {
+			bb_trap_instr = create_basicblock(cpu, pc, cpu->cur_func, BB_TYPE_TRAP);
+			emit_trap_callout(cpu, next_pc, bb_trap_instr, bb_trap, bb_dispatch, bb_ret);
+		}
+
+		if (REPORTING) {
+			report_mark_t mark = report_instr_start(cpu, cur_bb);
+			bb_cont = translate_instr(cpu, pc, tag, bb_target, bb_trap_instr, bb_next, cur_bb);
+			report_instr_done(cpu, pc, bb_pc, &mark);
+		} else
+			bb_cont = translate_instr(cpu, pc, tag, bb_target, bb_trap_instr, bb_next, cur_bb);
+
+		pc = next_pc;
+		instrs++;
+		
+	} while (
+				/* new basic block starts here (and we haven't translated it yet)*/
+				(!is_start_of_basicblock(cpu, pc)) &&
+				/* end of code section */ //XXX no: this is whether it's TAG_CODE
+				is_code(cpu, pc) &&
+				/* last intruction jumped away */
+				bb_cont
+			);
+
+	/* link with next basic block if there isn't a control flow instr. already */
+	if (bb_cont) {
+		BasicBlock *target = lookup_target(cpu, loop, pc, bb_ret);
+		LOG("info: linking continue $%04llx!\n", (unsigned long long)pc);
+		BranchInst::Create(target, bb_cont);
+	}
+
+	if ((cpu->flags_codegen & CPU_CODEGEN_IDLE) && (tag & TAG_CONDITIONAL) &&
+		(tag & TAG_BRANCH) && new_pc == bb_pc) {
+		std::set<BasicBlock *> created, region;
+		for (Function::iterator b = bb_last; ++b != cpu->cur_func->end(); )
+			created.insert(b);
+		created.insert(bb_body);
+		if (is_idle_loop(cpu, bb_body, bb_target, bb_next, created, region)) {
+			LOG("idle loop: L%08llx\n", (unsigned long long)bb_pc);
+			emit_idle_exit(cpu, bb_pc, bb_target, region, bb_ret);
+		}
+	}
+
+	if (bb_entry != NULL)
+		emit_block_entry(cpu, bb_pc, instrs, cycles, bb_entry, bb_body, bb_ret);
+}
+
+/* add the starts of the blocks the block at pc can continue in */
+static void
+block_successors(cpu_t *cpu, addr_t pc, std::vector<addr_t> &todo)
+{
+	for (;;) {
+		tag_t tag = get_tag(cpu, pc), dummy1;
+		addr_t new_pc, next_pc;
+
+		cpu->f.tag_instr(cpu, pc, &dummy1, &new_pc, &next_pc);
+		if ((tag & TAG_BRANCH) && new_pc != NEW_PC_NONE)
+			todo.push_back(new_pc);
+		jumptable_map::const_iterator jt = cpu->jump_tables.find(pc);
+		if ((tag & TAG_BRANCH) && jt != cpu->jump_tables.end())
+			todo.insert(todo.end(), jt->second.begin(), jt->second.end());
+		/* the callee returns here, see emit_subroutine_call() */
+		if (tag & (TAG_CALL | TAG_CONDITIONAL | TAG_TRAP))
+			todo.push_back(next_pc);
+		if (!(tag & TAG_CONTINUE) || (tag & TAG_DELAY_SLOT))
+			return;
+
+		pc = next_pc;
+		if (is_start_of_basicblock(cpu, pc) || !is_code(cpu, pc)) {
+			todo.push_back(pc);
+			return;
+		}
+	}
+}
+
+/*
+ * A subroutine in its own function, with the signature of jitmain().
+ * It holds the blocks that can be reached from its entry without
+ * a guest return. A guest return leaves it with JIT_RETURN_NOERR,
+ * any other way out leaves it like jitmain() does, with the PC set.
+ * These are copies; jitmain() still has all blocks, to continue
+ * wherever a subroutine left.
+ */
+static void
+translate_subroutine(cpu_t *cpu, addr_t entry, Function *f)
+{
+	BasicBlock *bb_ret, *bb_trap, *label_entry;
+	Function *caller = cpu->cur_func;
+	function_state_t state;
+
+	save_function_state(cpu, &state);
+	cpu->cur_func = f;
+	cpu_define_function(cpu, f, &bb_ret, &bb_trap, &label_entry);
+
+	BasicBlock *bb_return = BasicBlock::Create(_CTX(), "return", f, 0);
+	new StoreInst(ConstantInt::get(getIntegerType(32), JIT_RETURN_NOERR),
+		cpu->ptr_exit_code, bb_return);
+	BranchInst::Create(bb_ret, bb_return);
+
+	bbaddr_map &bb_addr = cpu->func_bb[f];
+	std::vector<addr_t> todo;
+	todo.push_back(entry);
+	while (!todo.empty()) {
+		addr_t pc = todo.back();
+		todo.pop_back();
+		if (bb_addr.find(pc) != bb_addr.end() || !is_code(cpu, pc) ||
+			is_hooked(cpu, pc))
+			continue;
+		create_basicblock(cpu, pc, f, BB_TYPE_NORMAL);
+		block_successors(cpu, pc, todo);
+	}
+	LOG("subroutine: L%08llx, %zu bbs\n", (unsigned long long)entry, bb_addr.size());
+
+	/* the exit code is JIT_RETURN_FUNCNOTFOUND unless set */
+	func_ctx_t ctx = { bb_ret, bb_return, bb_ret, bb_trap, NULL };
+	for (bbaddr_map::const_iterator it = bb_addr.begin(); it != bb_addr.end(); it++) {
+		LOG("basicblock: S%08llx L%08llx\n", (unsigned long long)entry,
+			(unsigned long long)it->first);
+		translate_block(cpu, it->first, it->second, &ctx);
+	}
+
+	BranchInst::Create(bb_addr[entry], label_entry);
+
+	cpu->cur_func = caller;
+	restore_function_state(cpu, &state);
+}
 
 BasicBlock *
 cpu_translate_all(cpu_t *cpu, BasicBlock *bb_ret, BasicBlock *bb_trap)
@@ -31,13 +580,40 @@ cpu_translate_all(cpu_t *cpu, BasicBlock *bb_ret, BasicBlock *bb_trap)
 		}
 		pc++;
 	}
+	// hooked addresses can be outside the code, or not tagged
+	bbaddr_map &bb_func = cpu->func_bb[cpu->cur_func];
+	for (hook_map::const_iterator h = cpu->hooks.begin(); h != cpu->hooks.end(); h++) {
+		if (bb_func.find(h->first) == bb_func.end()) {
+			create_basicblock(cpu, h->first, cpu->cur_func, BB_TYPE_NORMAL);
+			bbs++;
+		}
+	}
 	LOG("bbs: %d\n", bbs);
 
+	loop_map loops;
+	if (cpu->flags_codegen & CPU_CODEGEN_LOOPS)
+		find_loops(cpu, bb_func, loops);
+
+	// declare the subroutines, so calls can be emitted
+	cpu->sub_func.clear();
+	if (cpu->flags_codegen & CPU_CODEGEN_SUBROUTINES) {
+		for (bbaddr_map::const_iterator b = bb_func.begin(); b != bb_func.end(); b++) {
+			if (!(get_tag(cpu, b->first) & TAG_SUBROUTINE) || is_hooked(cpu, b->first))
+				continue;
+			char name[24];
+			snprintf(name, sizeof(name), "sub_%08llx", (unsigned long long)b->first);
+			cpu->sub_func[b->first] = cpu_declare_function(cpu, name);
+			cpu->sub_funcs.push_back(cpu->sub_func[b->first]);
+		}
+	}
+
 	// create dispatch basicblock
 	BasicBlock* bb_dispatch = BasicBlock::Create(_CTX(), "dispatch", cpu->cur_func, 0);
 	Value *v_pc = new LoadInst(cpu->ptr_PC, "", false, bb_dispatch);
 	SwitchInst* sw = SwitchInst::Create(v_pc, bb_ret, bbs, bb_dispatch);
 
+	func_ctx_t ctx = { bb_dispatch, bb_dispatch, bb_ret, bb_trap, NULL };
+
 	// translate basic blocks
 	bbaddr_map &bb_addr = cpu->func_bb[cpu->cur_func];
 	bbaddr_map::const_iterator it;
@@ -45,9 +621,6 @@ cpu_translate_all(cpu_t *cpu, BasicBlock *bb_ret, BasicBlock *bb_trap)
 		pc = it->first;
 		BasicBlock *cur_bb = it->second;
 
-		tag_t tag;
-		BasicBlock *bb_target = NULL, *bb_next = NULL, *bb_cont = NULL;
-
 		// Tag the function as translated.
 		or_tag(cpu, pc, TAG_TRANSLATED);
 
@@ -57,51 +630,34 @@ cpu_translate_all(cpu_t *cpu, BasicBlock *bb_ret, BasicBlock *bb_trap)
 		ConstantInt* c = ConstantInt::get(getIntegerType(cpu->info.address_size), pc);
 		sw->addCase(c, cur_bb);
 
-		do {
-			tag_t dummy1;
-
-			if (LOGGING)
-				disasm_instr(cpu, pc);
+		if (is_hooked(cpu, pc)) {
+			emit_hook(cpu, pc, cur_bb, bb_dispatch, bb_trap);
+			continue;
+		}
 
-			tag = get_tag(cpu, pc);
+		// A loop header continues in the copy of the loop.
+		loop_map::iterator l = loops.find(pc);
+		if (l != loops.end()) {
+			BranchInst::Create(l->second.bbs[pc], cur_bb);
+			continue;
+		}
 
-			/* get address of the following instruction */
-			addr_t new_pc, next_pc;
-			cpu->f.tag_instr(cpu, pc, &dummy1, &new_pc, &next_pc);
+		translate_block(cpu, pc, cur_bb, &ctx);
+	}
 
-			/* get target basic block */
-			if (tag & TAG_RET)
-				bb_target = bb_dispatch;
-			if (tag & (TAG_CALL|TAG_BRANCH)) {
-				if (new_pc == NEW_PC_NONE) /* translate_instr() will set PC */
-					bb_target = bb_dispatch;
-				else
-					bb_target = (BasicBlock*)lookup_basicblock(cpu, cpu->cur_func, new_pc, bb_ret, BB_TYPE_NORMAL);
-			}
-			/* get not-taken basic block */
-			if (tag & TAG_CONDITIONAL)
- 				bb_next = (BasicBlock*)lookup_basicblock(cpu, cpu->cur_func, next_pc, bb_ret, BB_TYPE_NORMAL);
-
-			bb_cont = translate_instr(cpu, pc, tag, bb_target, bb_trap, bb_next, cur_bb);
-
-			pc = next_pc;
-			
-		} while (
-					/* new basic block starts here (and we haven't translated it yet)*/
-					(!is_start_of_basicblock(cpu, pc)) &&
-					/* end of code section */ //XXX no: this is whether it's TAG_CODE
-					is_code(cpu, pc) &&
-					/* last intruction jumped away */
-					bb_cont
-				);
-
-		/* link with next basic block if there isn't a control flow instr. already */
-		if (bb_cont) {
-			BasicBlock *target = (BasicBlock*)lookup_basicblock(cpu, cpu->cur_func, pc, bb_ret, BB_TYPE_NORMAL);
-			LOG("info: linking continue $%04llx!\n", (unsigned long long)pc);
-			BranchInst::Create(target, bb_cont);
+	// translate the loop copies
+	for (loop_map::iterator l = loops.begin(); l != loops.end(); l++) {
+		func_ctx_t loop_ctx = ctx;
+		loop_ctx.loop = &l->second;
+		for (it = l->second.bbs.begin(); it != l->second.bbs.end(); it++) {
+			LOG("basicblock: O%08llx\n", (unsigned long long)it->first);
+			translate_block(cpu, it->first, it->second, &loop_ctx);
 		}
-    }
+	}
+
+	// translate the subroutines
+	for (subfunc_map::const_iterator s = cpu->sub_func.begin(); s != cpu->sub_func.end(); s++)
+		translate_subroutine(cpu, s->first, s->second);
 
 	return bb_dispatch;
 }
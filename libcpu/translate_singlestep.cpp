@@ -14,6 +14,7 @@
 #include "tag.h"
 #include "basicblock.h"
 #include "translate.h"
+#include "frontend.h"
 
 //////////////////////////////////////////////////////////////////////
 // single stepping
@@ -51,6 +52,10 @@ cpu_translate_singlestep(cpu_t *cpu, BasicBlock *bb_ret, BasicBlock *bb_trap)
 	if (tag & TAG_CONDITIONAL)
 		bb_next = create_singlestep_return_basicblock(cpu, next_pc, bb_ret);
 
+	int taken;
+	arch_add_cycles(cpu, ConstantInt::get(getIntegerType(64),
+		instr_cycles(cpu, pc, tag, &taken)), cur_bb);
+
 	bb_cont = translate_instr(cpu, pc, tag, bb_target, bb_trap, bb_next, cur_bb);
 
 	/* If it's not a branch, append "store PC & return" to basic block */
@@ -5,11 +5,13 @@
  * Tight loops will not exit, but loop inside the translation.
  */
 #include "libcpu.h"
+#include "libcpu_llvm.h"
 #include "basicblock.h"
 #include "disasm.h"
 #include "tag.h"
 #include "translate.h"
 #include "translate_singlestep.h"
+#include "frontend.h"
 
 BasicBlock *
 cpu_translate_singlestep_bb(cpu_t *cpu, BasicBlock *bb_ret, BasicBlock *bb_trap)
@@ -47,6 +49,10 @@ cpu_translate_singlestep_bb(cpu_t *cpu, BasicBlock *bb_ret, BasicBlock *bb_trap)
 		if (tag & TAG_CONDITIONAL)
 			bb_next = create_singlestep_return_basicblock(cpu, next_pc, bb_ret);
 
+		int taken;
+		arch_add_cycles(cpu, ConstantInt::get(getIntegerType(64),
+			instr_cycles(cpu, pc, tag, &taken)), cur_bb);
+
 		bb_cont = translate_instr(cpu, pc, tag, bb_target, bb_trap, bb_next, cur_bb);
 
 		pc = next_pc;
@@ -0,0 +1,88 @@
+/*
+ * libcpu: trap.cpp
+ *
+ * Trap callouts (cpu_set_trap_function()). Instead of returning
+ * JIT_RETURN_TRAP from the translated function, a trap instruction
+ * writes back the registers the handler needs, calls it directly
+ * and continues in place:
+ *
+ *     spill flags, XRs and the masked GPRs
+ *     rc = trap_function(cpu)
+ *     reload them
+ *     if (rc != CPU_TRAP_RESUME) goto trap;
+ *     if (PC == next_pc) goto next block; else goto dispatch;
+ *
+ * The handler and the mask are baked into the code, so they have
+ * to be set before translating.
+ */
+
+#include <vector>
+
+#include "llvm/Constants.h"
+#include "llvm/DerivedTypes.h"
+#include "llvm/Instructions.h"
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/Target/TargetData.h"
+
+#include "libcpu.h"
+#include "libcpu_llvm.h"
+#include "basicblock.h"
+#include "function.h"
+#include "trap.h"
+
+/*
+ * bb is entered instead of bb_trap by the trap instruction at
+ * next_pc - length; the instruction has already set the PC.
+ */
+void
+emit_trap_callout(cpu_t *cpu, addr_t next_pc, BasicBlock *bb,
+	BasicBlock *bb_trap, BasicBlock *bb_dispatch, BasicBlock *bb_ret)
+{
+	Type const *intptr_type = cpu->exec_engine->getTargetData()->getIntPtrType(_CTX());
+	PointerType *type_pintptr = PointerType::getUnqual(intptr_type);
+
+	spill_callout_state(cpu, cpu->trap_gpr_mask, bb);
+
+	// int (*)(cpu_t *)
+	std::vector<const Type*> type_func_args;
+	type_func_args.push_back(type_pintptr);
+	FunctionType *type_func = FunctionType::get(getIntegerType(32),
+		type_func_args, false);
+
+	Constant *v_func = ConstantExpr::getIntToPtr(
+		ConstantInt::get(intptr_type, (uintptr_t)cpu->trap_function),
+		PointerType::getUnqual(type_func));
+	Value *rc = CallInst::Create(v_func, cpu->ptr_cpu, "", bb);
+
+	reload_callout_state(cpu, cpu->trap_gpr_mask, bb);
+
+	BasicBlock *bb_resume = BasicBlock::Create(_CTX(), "", cpu->cur_func, 0);
+	Value *resume = new ICmpInst(*bb, ICmpInst::ICMP_EQ, rc,
+		ConstantInt::get(getIntegerType(32), CPU_TRAP_RESUME), "");
+	BranchInst::Create(bb_resume, bb_trap, resume, bb);
+
+	// the usual case is a system call that returns to the next instruction
+	BasicBlock *bb_next = (BasicBlock*)lookup_basicblock(cpu, cpu->cur_func,
+		next_pc, bb_ret, BB_TYPE_NORMAL);
+	Value *v_pc = new LoadInst(cpu->ptr_PC, "", false, bb_resume);
+	Value *same = new ICmpInst(*bb_resume, ICmpInst::ICMP_EQ, v_pc,
+		ConstantInt::get(getIntegerType(cpu->info.address_size), next_pc), "");
+	BranchInst::Create(bb_next, bb_dispatch, same, bb_resume);
+}
+
+//////////////////////////////////////////////////////////////////////
+// interface
+//////////////////////////////////////////////////////////////////////
+
+/*
+ * gpr_mask has one bit per GPR the handler reads or writes (the
+ * system call ABI); GPRs above 63 are always synced. The handler
+ * must not change GPRs outside the mask, or the FPRs.
+ * Takes effect for code translated afterwards.
+ */
+void
+cpu_set_trap_function(cpu_t *cpu, trap_function_t f, uint64_t gpr_mask)
+{
+	cpu->trap_function = f;
+	cpu->trap_gpr_mask = gpr_mask;
+}
@@ -0,0 +1,2 @@
+void emit_trap_callout(cpu_t *cpu, addr_t next_pc, BasicBlock *bb,
+	BasicBlock *bb_trap, BasicBlock *bb_dispatch, BasicBlock *bb_ret);
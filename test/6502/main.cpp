@@ -78,6 +78,29 @@ kernal_dispatch(
 	unsigned char *s,
 	unsigned char *p); //XXX
 
+/* the addresses kernal_dispatch() handles */
+static const addr_t kernal_entries[] = {
+	0x0073, 0x0079, 0xFF90, 0xFF99, 0xFF9C, 0xFFB7, 0xFFBA, 0xFFBD,
+	0xFFC0, 0xFFC3, 0xFFC6, 0xFFC9, 0xFFCC, 0xFFCF, 0xFFD2, 0xFFD5,
+	0xFFD8, 0xFFDB, 0xFFDE, 0xFFE1, 0xFFE4, 0xFFE7, 0xFFF0, 0xFFF3
+};
+
+/* JSR'd, all registers in and out, RTS pops the address - 1 from $0100+S+1 */
+static const cpu_hook_abi_t kernal_abi = {
+	0, { 0 }, CPU_HOOK_NO_REG,
+	CPU_HOOK_RETURN_STACK, CPU_HOOK_NO_REG,
+	3, 0x0100, 1, 2, 1,	/* S, stack page, S+1, 16 bit, +1 */
+	0xF,	/* A, X, Y, S */
+	false
+};
+
+static uint64_t
+kernal_hook(cpu_t *cpu) {
+	reg_6502_t *reg = (reg_6502_t*)cpu->rf.grf;
+	kernal_dispatch(cpu->RAM, &reg->pc, &reg->a, &reg->x, &reg->y, &reg->s, &reg->p);
+	return 0;
+}
+
 
 #define SINGLESTEP_NONE	0
 #define SINGLESTEP_STEP	1
@@ -92,14 +115,24 @@ main(int argc, char **argv) {
 	int singlestep = SINGLESTEP_NONE;
 	int log = 0;
 	int print_ir = 0;
+	int fuse = 1;
+
+	if (argc >= 2 && !strcmp(argv[1], "-nofuse")) { /* compare without idioms */
+		fuse = 0;
+		argv[1] = argv[0];
+		argc--;
+		argv++;
+	}
 
 	int ramsize = 65536;
-	RAM = (uint8_t*)malloc(ramsize);
+	RAM = cpu_alloc_ram(ramsize);
 
 	cpu = cpu_new(CPU_ARCH_6502, 0, CPU_6502_BRK_TRAP |
 		CPU_6502_XXX_TRAP | CPU_6502_V_IGNORE);
 
-	cpu_set_flags_codegen(cpu, CPU_CODEGEN_OPTIMIZE);
+	cpu_set_flags_codegen(cpu, CPU_CODEGEN_OPTIMIZE
+		| (fuse? CPU_CODEGEN_FUSE : 0)
+		);
 	cpu_set_flags_debug(cpu, 0
 		| (print_ir? CPU_DEBUG_PRINT_IR : 0)
 		| (print_ir? CPU_DEBUG_PRINT_IR_OPTIMIZED : 0)
@@ -109,9 +142,13 @@ main(int argc, char **argv) {
 		);
 	cpu_set_ram(cpu, RAM);
 
+	/* call the kernal emulation from translated code */
+	for (size_t i = 0; i < sizeof(kernal_entries) / sizeof(kernal_entries[0]); i++)
+		cpu_hook(cpu, kernal_entries[i], kernal_hook, &kernal_abi);
+
 /* parameter parsing */
 	if (argc<2) {
-		printf("Usage: %s executable [entries]\n", argv[0]);
+		printf("Usage: %s [-nofuse] executable [entries]\n", argv[0]);
 		return 0;
 	}
 
@@ -123,16 +160,13 @@ main(int argc, char **argv) {
 
 /* load code */
 
-	FILE *f;
-
-	if (!(f = fopen(executable, "rb"))) {
+	cpu->code_start = 0xA000;
+	int64_t size = cpu_map_image(cpu, executable, 0, cpu->code_start, ramsize-cpu->code_start);
+	if (size < 0) {
 		printf("Could not open %s!\n", executable);
 		return 2;
 	}
-
-	cpu->code_start = 0xA000;
-	cpu->code_end = cpu->code_start + fread(&RAM[cpu->code_start], 1, ramsize-cpu->code_start, f);
-	fclose(f);
+	cpu->code_end = cpu->code_start + size;
 
 	cpu->code_entry = RAM[cpu->code_start] | RAM[cpu->code_start+1]<<8; /* start vector at beginning ($A000) */
 
@@ -78,7 +78,7 @@ main(int argc, char **argv) {
 	uint8_t *RAM;
 
 	int ramsize = 65536;
-	RAM = (uint8_t*)malloc(ramsize);
+	RAM = cpu_alloc_ram(ramsize);
 
 	cpu = cpu_new(CPU_ARCH_ARM, CPU_FLAG_ENDIAN_LITTLE, 0);
 	cpu_set_flags_codegen(cpu, CPU_CODEGEN_OPTIMIZE);
@@ -106,16 +106,13 @@ main(int argc, char **argv) {
 
 /* load code */
 
-	FILE *f;
-
-	if (!(f = fopen(executable, "rb"))) {
+	cpu->code_start = 0;
+	int64_t size = cpu_map_image(cpu, executable, 0, cpu->code_start, ramsize-cpu->code_start);
+	if (size < 0) {
 		printf("Could not open %s!\n", executable);
 		return 2;
 	}
-
-	cpu->code_start = 0;
-	cpu->code_end = cpu->code_start + fread(&RAM[cpu->code_start], 1, ramsize-cpu->code_start, f);
-	fclose(f);
+	cpu->code_end = cpu->code_start + size;
 
 	cpu->code_entry = cpu->code_start;
 
@@ -0,0 +1,317 @@
+/*
+ * libcpu: emitters.cpp
+ *
+ * Test harness for the generic emitters in libcpu/frontend.cpp.
+ * Every case JITs one emitter in isolation into its own jitmain(),
+ * compares the optimized IR against a golden file and times the
+ * generated code.
+ *
+ * Usage: test_emitters [-u] [-n iterations] [golden dir]
+ *   -u  rewrite the golden files instead of comparing them
+ *
+ * A case without a golden file fails; record it with -u.
+ */
+
+#include <string>
+
+#include "llvm/Analysis/Verifier.h"
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/Function.h"
+#include "llvm/Instructions.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "libcpu.h"
+#include "libcpu_llvm.h"
+#include "frontend.h"
+#include "function.h"
+#include "optimize.h"
+#include "timings.h"
+
+#define ITERATIONS 10000000
+#define RAM_SIZE 65536
+
+typedef void (*emit_t)(cpu_t *cpu, BasicBlock *bb);
+
+typedef struct {
+	char const *name;
+	cpu_arch_t arch;
+	uint32_t flags;
+	emit_t emit;
+} emitter_case_t;
+
+typedef int (*fp_t)(uint8_t *RAM, void *grf, void *frf, debug_function_t fp, cpu_t *cpu);
+
+//////////////////////////////////////////////////////////////////////
+// cases
+//////////////////////////////////////////////////////////////////////
+
+/*
+ * The MIPS cases take their operands from r1 (address) and
+ * r2 (value), and leave their result in r2 and r3.
+ */
+
+static void emit_nop(cpu_t *cpu, BasicBlock *bb) {}
+
+static void emit_load8(cpu_t *cpu, BasicBlock *bb) { LOAD8(2, R(1)); }
+static void emit_load8s(cpu_t *cpu, BasicBlock *bb) { LOAD8S(2, R(1)); }
+static void emit_load16(cpu_t *cpu, BasicBlock *bb) { LOAD16(2, R(1)); }
+static void emit_load32(cpu_t *cpu, BasicBlock *bb) { LOAD32(2, R(1)); }
+static void emit_store8(cpu_t *cpu, BasicBlock *bb) { STORE8(R(2), R(1)); }
+static void emit_store16(cpu_t *cpu, BasicBlock *bb) { STORE16(R(2), R(1)); }
+static void emit_store32(cpu_t *cpu, BasicBlock *bb) { STORE32(R(2), R(1)); }
+
+static void
+emit_bswap16(cpu_t *cpu, BasicBlock *bb)
+{
+	LET(2, ZEXT32(SWAP16(TRUNC16(R(1)))));
+}
+
+static void
+emit_bswap32(cpu_t *cpu, BasicBlock *bb)
+{
+	LET(2, SWAP32(R(1)));
+}
+
+static void
+emit_bswap64(cpu_t *cpu, BasicBlock *bb)
+{
+	Value *v = OR(SHL(ZEXT64(R(1)), CONST64(32)), ZEXT64(R(2)));
+	v = SWAP64(v);
+	LET(2, TRUNC32(v));
+	LET(3, TRUNC32(LSHR(v, CONST64(32))));
+}
+
+/*
+ * The 6502 cases work on A (GPR 0), X (GPR 1) and the flags.
+ */
+
+static void
+emit_6502_adc(cpu_t *cpu, BasicBlock *bb)
+{
+	SET_NZ(ADC(cpu->ptr_gpr[0], cpu->ptr_gpr[0], R(1), true, false));
+}
+
+static void
+emit_6502_cmp(cpu_t *cpu, BasicBlock *bb)
+{
+	SET_NZ(ADC(NULL, cpu->ptr_gpr[0], COM(R(1)), false, true));
+}
+
+static void
+emit_6502_asl(cpu_t *cpu, BasicBlock *bb)
+{
+	SET_NZ(SHIFTROTATE(cpu->ptr_gpr[0], cpu->ptr_gpr[0], true, false));
+}
+
+static void
+emit_6502_ror(cpu_t *cpu, BasicBlock *bb)
+{
+	SET_NZ(SHIFTROTATE(cpu->ptr_gpr[0], cpu->ptr_gpr[0], false, true));
+}
+
+static void
+emit_6502_flags_encode(cpu_t *cpu, BasicBlock *bb)
+{
+	LET(1, arch_flags_encode(cpu, bb));
+}
+
+#define MIPS_CASES(e, flags) \
+	{ "mips" e "_nop",     CPU_ARCH_MIPS, flags, emit_nop }, \
+	{ "mips" e "_load8",   CPU_ARCH_MIPS, flags, emit_load8 }, \
+	{ "mips" e "_load8s",  CPU_ARCH_MIPS, flags, emit_load8s }, \
+	{ "mips" e "_load16",  CPU_ARCH_MIPS, flags, emit_load16 }, \
+	{ "mips" e "_load32",  CPU_ARCH_MIPS, flags, emit_load32 }, \
+	{ "mips" e "_store8",  CPU_ARCH_MIPS, flags, emit_store8 }, \
+	{ "mips" e "_store16", CPU_ARCH_MIPS, flags, emit_store16 }, \
+	{ "mips" e "_store32", CPU_ARCH_MIPS, flags, emit_store32 }, \
+	{ "mips" e "_bswap16", CPU_ARCH_MIPS, flags, emit_bswap16 }, \
+	{ "mips" e "_bswap32", CPU_ARCH_MIPS, flags, emit_bswap32 }, \
+	{ "mips" e "_bswap64", CPU_ARCH_MIPS, flags, emit_bswap64 }
+
+static emitter_case_t cases[] = {
+	MIPS_CASES("be", CPU_FLAG_ENDIAN_BIG),
+	MIPS_CASES("le", CPU_FLAG_ENDIAN_LITTLE),
+	{ "6502_nop",          CPU_ARCH_6502, 0, emit_nop },
+	{ "6502_adc",          CPU_ARCH_6502, 0, emit_6502_adc },
+	{ "6502_cmp",          CPU_ARCH_6502, 0, emit_6502_cmp },
+	{ "6502_asl",          CPU_ARCH_6502, 0, emit_6502_asl },
+	{ "6502_ror",          CPU_ARCH_6502, 0, emit_6502_ror },
+	{ "6502_flags_encode", CPU_ARCH_6502, 0, emit_6502_flags_encode },
+	{ NULL, CPU_ARCH_INVALID, 0, NULL }
+};
+
+//////////////////////////////////////////////////////////////////////
+// harness
+//////////////////////////////////////////////////////////////////////
+
+/* build jitmain() around the emitter and optimize it */
+static Function *
+build_case(cpu_t *cpu, emitter_case_t *c)
+{
+	BasicBlock *bb_ret, *bb_trap, *label_entry;
+
+	cpu->cur_func = cpu_create_function(cpu, c->name, &bb_ret, &bb_trap, &label_entry);
+
+	BasicBlock *bb = BasicBlock::Create(_CTX(), "body", cpu->cur_func, 0);
+	c->emit(cpu, bb);
+	BranchInst::Create(bb_ret, bb);
+	BranchInst::Create(bb, label_entry);
+
+	verifyFunction(*cpu->cur_func, PrintMessageAction);
+	optimize(cpu);
+	return cpu->cur_func;
+}
+
+static bool
+read_file(std::string const &path, std::string &data)
+{
+	FILE *f = fopen(path.c_str(), "rb");
+	char buf[4096];
+	size_t n;
+
+	if (f == NULL)
+		return false;
+	data.clear();
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+		data.append(buf, n);
+	fclose(f);
+	return true;
+}
+
+static bool
+write_file(std::string const &path, std::string const &data)
+{
+	FILE *f = fopen(path.c_str(), "wb");
+
+	if (f == NULL) {
+		printf("Could not write %s!\n", path.c_str());
+		return false;
+	}
+	fwrite(data.data(), 1, data.size(), f);
+	fclose(f);
+	return true;
+}
+
+/* the initial register contents; the address in r1 stays inside RAM */
+static void
+init_regs(cpu_t *cpu, uint8_t *RAM)
+{
+	unsigned i;
+
+	for (i = 0; i < RAM_SIZE; i++)
+		RAM[i] = (uint8_t)(i * 7);
+
+	if (cpu->info.type == CPU_ARCH_MIPS) {
+		uint32_t *r = (uint32_t *)cpu->rf.grf;
+		r[1] = 0x1232;
+		r[2] = 0x89abcdef;
+		r[3] = 0;
+	} else {
+		uint8_t *r = (uint8_t *)cpu->rf.grf;
+		r[0] = 0x7f;
+		r[1] = 0x81;
+	}
+}
+
+static uint64_t
+time_case(cpu_t *cpu, void *code, uint8_t *RAM, unsigned iterations)
+{
+	fp_t FP = (fp_t)code;
+	uint64_t t1, t2;
+	unsigned i;
+
+	init_regs(cpu, RAM);
+	t1 = abs_time();
+	for (i = 0; i < iterations; i++)
+		FP(RAM, cpu->rf.grf, cpu->rf.frf, NULL, cpu);
+	t2 = abs_time();
+	return t2 - t1;
+}
+
+int
+main(int argc, char **argv)
+{
+	char const *golden_dir = GOLDEN_DIR;
+	unsigned iterations = ITERATIONS;
+	bool update = false;
+	int failed = 0, recorded = 0;
+	uint64_t t_nop[CPU_ARCH_FAPRA + 1];
+	uint8_t *RAM;
+	int i;
+
+	/* parameter parsing */
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-u"))
+			update = true;
+		else if (!strcmp(argv[i], "-n") && i + 1 < argc)
+			iterations = atoi(argv[++i]);
+		else if (argv[i][0] == '-') {
+			printf("Usage: %s [-u] [-n iterations] [golden dir]\n", argv[0]);
+			return 0;
+		} else
+			golden_dir = argv[i];
+	}
+
+	RAM = (uint8_t *)malloc(RAM_SIZE);
+	memset(t_nop, 0, sizeof(t_nop));
+
+	printf("%-24s %-8s %12s %10s\n", "case", "IR", "time", "-nop");
+	for (emitter_case_t *c = cases; c->name != NULL; c++) {
+		cpu_t *cpu = cpu_new(c->arch, c->flags, 0);
+		cpu_set_flags_codegen(cpu, CPU_CODEGEN_OPTIMIZE);
+		cpu_set_ram(cpu, RAM);
+
+		Function *func = build_case(cpu, c);
+
+		/* compare the optimized IR against the golden file */
+		std::string ir, golden;
+		raw_string_ostream os(ir);
+		func->print(os);
+		os.flush();
+
+		std::string path = std::string(golden_dir) + "/" + c->name + ".ll";
+		char const *status;
+		if (update) {
+			if (write_file(path, ir)) {
+				status = "recorded";
+				recorded++;
+			} else {
+				status = "FAILED";
+				failed++;
+			}
+		} else if (!read_file(path, golden)) {
+			status = "MISSING";
+			failed++;
+		} else if (golden != ir) {
+			status = "FAILED";
+			failed++;
+		} else
+			status = "ok";
+
+		/* time the generated code */
+		void *code = cpu->exec_engine->getPointerToFunction(func);
+		uint64_t t = time_case(cpu, code, RAM, iterations);
+		if (c->emit == emit_nop)
+			t_nop[c->arch] = t;
+
+		printf("%-24s %-8s %12llu %10lld\n", c->name, status,
+			(unsigned long long)t, (long long)(t - t_nop[c->arch]));
+		if (!strcmp(status, "FAILED") && !update) {
+			printf("--- expected (%s)\n%s", path.c_str(), golden.c_str());
+			printf("+++ got\n%s", ir.c_str());
+		}
+
+		cpu_free(cpu);
+	}
+
+	free(RAM);
+
+	if (recorded)
+		printf("%d golden file(s) recorded in %s\n", recorded, golden_dir);
+	if (failed) {
+		printf("\033[1m%d case(s) FAILED!\033[22m\n", failed);
+		return 1;
+	}
+	printf("\033[1mSUCCESS!\033[22m\n");
+	return 0;
+}
@@ -25,6 +25,7 @@
 #cmakedefine HAVE_GETHOSTID 1
 #cmakedefine HAVE_ISSETUGID 1
 #cmakedefine HAVE_KQUEUE 1
+#cmakedefine HAVE_LIBURING 1
 #cmakedefine HAVE_NICE 1
 #cmakedefine HAVE_PTHREAD_YIELD 1
 #cmakedefine HAVE_REVOKE 1
@@ -61,6 +61,9 @@ int nix_ioctl(int fd, unsigned long request, void *data, nix_env_t *env);
 int nix_fcntl(int fd, int cmd, int arg, nix_env_t *env);
 int nix_select(int highestfd, nix_fd_set *rfds, nix_fd_set *wfds, nix_fd_set *xfds, struct nix_timeval const *tv, nix_env_t *env);
 int nix_poll(struct nix_pollfd *fds, nix_nfds_t nfds, int timeout, nix_env_t *env);
+/* nix-uring.c */
+int nix_uring_init(unsigned entries);
+void nix_uring_set_wait_hook(int (*hook)(void *), void *arg);
 /* nix-process.c */
 void nix_exit(int exitcode);
 nix_pid_t nix_getpid(nix_env_t *env);
@@ -133,6 +136,7 @@ int nix_setdomainname(char const *domainname, size_t len, nix_env_t *env);
 uintmax_t nix_brk(uintmax_t ptr, nix_env_t *env);
 uintmax_t nix_sbrk(int incr, nix_env_t *env);
 uintmax_t nix_sstk(int incr, nix_env_t *env);
+int nix_mmap_arena(xec_gaddr_t base, size_t size, nix_env_t *env);
 xec_gaddr_t nix_mmap(xec_gaddr_t gaddr, size_t len, int prot, int flags, int fd, off_t offset, nix_env_t *env);
 int nix_munmap(uintmax_t addr, size_t len, nix_env_t *env);
 int nix_mlock(uintmax_t addr, size_t len, nix_env_t *env);
@@ -19,6 +19,7 @@
 
 #include "nix.h"
 #include "nix-fd.h"
+#include "nix-uring.h"
 #include "nix-structs.h"
 #include "xec-mem.h"
 #include "xec-debug.h"
@@ -158,7 +159,7 @@ nix_read(int fd, void *buf, size_t bufsiz, nix_env_t *env)
 	if (bufsiz == 0)
 		return (0);
 
-	nb = read(rfd, buf, bufsiz);
+	nb = nix_uring_read(rfd, buf, bufsiz);
 	if (nb < 0)
 		nix_env_set_errno(env, errno);
 
@@ -191,7 +192,7 @@ nix_readv(int fd, struct nix_iovec const *iov, int iovcnt, nix_env_t *env)
 	if (iovcnt == 0)
 		return 0;
 
-	nb = readv(rfd, (struct iovec *)iov, iovcnt);
+	nb = nix_uring_readv(rfd, (struct iovec *)iov, iovcnt);
 	if (nb < 0)
 		nix_env_set_errno(env, errno);
 
@@ -219,7 +220,7 @@ nix_write(int fd, void const *buf, size_t bufsiz, nix_env_t *env)
 	if (bufsiz == 0)
 		return (0);
 
-	nb = write(rfd, buf, bufsiz);
+	nb = nix_uring_write(rfd, buf, bufsiz);
 	if (nb < 0)
 		nix_env_set_errno(env, errno);
 
@@ -255,7 +256,7 @@ nix_writev(int fd, struct nix_iovec const *iov, int iovcnt, nix_env_t *env)
 	if (iovcnt == 0)
 	  return 0;
 
-	nb = writev(rfd, (struct iovec *)iov, iovcnt);
+	nb = nix_uring_writev(rfd, (struct iovec *)iov, iovcnt);
 	if (nb < 0)
 	  nix_env_set_errno(env, errno);
 
@@ -577,6 +578,9 @@ done:
 	return (rc);
 }
 
+/* Number of descriptors polled without a heap allocation. */
+#define NIX_POLL_BATCH 32
+
 static __inline int
 nix_poll_events_to(int events)
 {
@@ -672,6 +676,7 @@ nix_poll(struct nix_pollfd *fds,
 	int            rc;
 	size_t         n;
 	struct pollfd *_fds;
+	struct pollfd  _fdsbuf[NIX_POLL_BATCH];
 
 	XEC_LOG(g_nix_log, XEC_LOG_DEBUG, 0, "fds=%p, nfds=%u, timeout=%d", fds, nfds, timeout);
 
@@ -686,7 +691,10 @@ nix_poll(struct nix_pollfd *fds,
 		return (-1);
 	}
 
-	_fds = xec_mem_alloc_ntype(struct pollfd, nfds, 0);
+	if (nfds <= NIX_POLL_BATCH)
+		_fds = _fdsbuf;
+	else
+		_fds = xec_mem_alloc_ntype(struct pollfd, nfds, 0);
 	if (_fds == NULL) {
 		nix_env_set_errno(env, ENOMEM);
 		return (-1);
@@ -698,7 +706,7 @@ nix_poll(struct nix_pollfd *fds,
 		_fds[n].revents = 0;
 	}
 
-	rc = poll(_fds, nfds, timeout);
+	rc = nix_uring_poll(_fds, nfds, timeout);
 	if (rc < 0) {
 		nix_env_set_errno(env, errno);
 		goto done;
@@ -712,7 +720,8 @@ nix_poll(struct nix_pollfd *fds,
 	}
 
 done:
-	xec_mem_free(_fds);
+	if (_fds != _fdsbuf)
+		xec_mem_free(_fds);
 
 	return (rc);
 }
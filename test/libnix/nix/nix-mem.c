@@ -1,3 +1,5 @@
+#include "nix-config.h"
+
 #include <sys/types.h>
 #include <sys/mman.h>
 #include <stdio.h>
@@ -6,12 +8,165 @@
 #include <errno.h>
 #include <unistd.h>
 
+#ifdef HAVE_BITSTRING_H
+#include <bitstring.h>
+#else
+#include "bsd-bitstring.h"
+#endif
+
 #include "nix.h"
+#include "nix-fd.h"
 #include "xec-mmap.h"
 #include "xec-debug.h"
 
+#ifndef MAP_ANON
+#define MAP_ANON MAP_ANONYMOUS
+#endif
+
 extern void *g_nix_log;
 
+/*
+ * Guest mmap arena: guest addresses whose host memory the client has
+ * reserved. Guest mappings are placed there with MAP_FIXED host
+ * mappings, so files are mapped straight into the guest address
+ * space. Free pages stay mapped PROT_NONE to keep the reservation.
+ * Without an arena, mappings are anonymous, go anywhere in the host
+ * and are translated with xec_mem_gmap.
+ */
+static xec_gaddr_t  nix_arena_base  = 0;
+static size_t       nix_arena_pages = 0;
+static bitstr_t    *nix_arena_used  = NULL;
+static size_t       nix_page_size   = 0;
+
+#define NIX_ARENA_PAGE(ga) ((size_t)(((ga) - nix_arena_base) / nix_page_size))
+
+static __inline int
+nix_arena_contains(xec_gaddr_t ga, size_t len)
+{
+	return (nix_arena_used != NULL &&
+			ga >= nix_arena_base &&
+			(ga - nix_arena_base) / nix_page_size <= nix_arena_pages &&
+			len <= (nix_arena_pages - NIX_ARENA_PAGE(ga)) * nix_page_size);
+}
+
+/* first run of `npages' free pages, or -1 */
+static ssize_t
+nix_arena_find(size_t npages)
+{
+	size_t n, run = 0;
+
+	for (n = 0; n < nix_arena_pages; n++) {
+		if (bit_test(nix_arena_used, n))
+			run = 0;
+		else if (++run == npages)
+			return (n + 1 - npages);
+	}
+	return (-1);
+}
+
+static __inline int
+nix_prot_to(int prot)
+{
+	int hprot = PROT_NONE;
+
+	if (prot & NIX_PROT_READ)
+		hprot |= PROT_READ;
+	if (prot & NIX_PROT_WRITE)
+		hprot |= PROT_WRITE;
+	if (prot & NIX_PROT_EXEC)
+		hprot |= PROT_EXEC;
+
+	return (hprot);
+}
+
+int
+nix_mmap_arena(xec_gaddr_t base, size_t size, nix_env_t *env)
+{
+	xec_mem_if_t  *mem = nix_env_get_memory(env);
+	xec_mem_flg_t  mf  = 0;
+	xec_haddr_t    ha;
+
+	nix_page_size = getpagesize();
+	if ((base & (nix_page_size - 1)) != 0 || size < nix_page_size)
+		return (0);
+
+	ha = xec_mem_gtoh(mem, base, &mf);
+	if (mf != 0)
+		return (0);
+
+	size &= ~(nix_page_size - 1);
+	if (mmap((void *)(uintptr_t)ha, size, PROT_NONE,
+			 MAP_ANON | MAP_PRIVATE | MAP_FIXED, -1, 0) == MAP_FAILED)
+		return (0);
+
+	nix_arena_used = bit_alloc(size / nix_page_size);
+	if (nix_arena_used == NULL)
+		return (0);
+
+	nix_arena_base  = base;
+	nix_arena_pages = size / nix_page_size;
+	return (1);
+}
+
+static xec_gaddr_t
+nix_mmap_in_arena(xec_gaddr_t gaddr, size_t len, int prot, int flags, int fd,
+	off_t offset, nix_env_t *env)
+{
+	xec_mem_if_t  *mem   = nix_env_get_memory(env);
+	xec_mem_flg_t  mf    = 0;
+	xec_haddr_t    ha;
+	xec_gaddr_t    ga;
+	size_t         npages;
+	ssize_t        page;
+	int            rfd   = -1;
+	int            hflags;
+
+	if (len == 0 || (offset & (nix_page_size - 1)) != 0) {
+		nix_env_set_errno(env, EINVAL);
+		return ((xec_gaddr_t)-1);
+	}
+	npages = (len + nix_page_size - 1) / nix_page_size;
+
+	if (flags & NIX_MAP_FIXED) {
+		if ((gaddr & (nix_page_size - 1)) != 0 ||
+			!nix_arena_contains(gaddr, npages * nix_page_size)) {
+			nix_env_set_errno(env, EINVAL);
+			return ((xec_gaddr_t)-1);
+		}
+		ga = gaddr;
+	} else {
+		page = nix_arena_find(npages);
+		if (page < 0) {
+			nix_env_set_errno(env, ENOMEM);
+			return ((xec_gaddr_t)-1);
+		}
+		ga = nix_arena_base + page * nix_page_size;
+	}
+
+	if (fd != -1 && (rfd = nix_fd_get(fd)) < 0) {
+		nix_env_set_errno(env, EBADF);
+		return ((xec_gaddr_t)-1);
+	}
+
+	hflags = MAP_FIXED;
+	hflags |= (flags & NIX_MAP_SHARED) ? MAP_SHARED : MAP_PRIVATE;
+	if (rfd < 0)
+		hflags |= MAP_ANON;
+
+	ha = xec_mem_gtoh(mem, ga, &mf);
+	if (mmap((void *)(uintptr_t)ha, len, nix_prot_to(prot), hflags, rfd,
+			 rfd < 0 ? 0 : offset) == MAP_FAILED) {
+		nix_env_set_errno(env, errno);
+		return ((xec_gaddr_t)-1);
+	}
+
+	bit_nset(nix_arena_used, NIX_ARENA_PAGE(ga), NIX_ARENA_PAGE(ga) + npages - 1);
+
+	XEC_LOG(g_nix_log, XEC_LOG_DEBUG, 0, "mapped %zu bytes of fd %d at 0x%llx", len, fd, (uint64_t)ga);
+
+	return (ga);
+}
+
 uintmax_t
 nix_brk(uintmax_t ptr, nix_env_t *env)
 {
@@ -56,6 +211,9 @@ nix_mmap(xec_gaddr_t gaddr, size_t len, int prot, int flags, int fd,
 
 	XEC_LOG(g_nix_log, XEC_LOG_DEBUG, 0, "nix prot = %x host flags = %x", prot, xf);
 
+	if (nix_arena_used != NULL)
+		return (nix_mmap_in_arena(gaddr, len, prot, flags, fd, offset, env));
+
 	if (flags & NIX_MAP_FIXED)
 		XEC_BUGCHECK (g_nix_log, 5040);
 
@@ -78,9 +236,31 @@ nix_mmap(xec_gaddr_t gaddr, size_t len, int prot, int flags, int fd,
 int
 nix_munmap (uintmax_t addr, size_t len, nix_env_t *env)
 {
+	xec_mem_if_t  *mem = nix_env_get_memory(env);
+	xec_mem_flg_t  mf  = 0;
+	xec_gaddr_t    ga;
+	size_t         npages;
+
     XEC_LOG(g_nix_log, XEC_LOG_DEBUG, 0, "addr=%llx, len=%08x", addr, len);
 
-	return 0;//(nix_nosys(env));
+	if (nix_arena_used == NULL || len == 0)
+		return (0);
+
+	ga = xec_mem_htog(mem, (xec_haddr_t)addr, &mf);
+	npages = (len + nix_page_size - 1) / nix_page_size;
+	if (mf != 0 || (ga & (nix_page_size - 1)) != 0 ||
+		!nix_arena_contains(ga, npages * nix_page_size))
+		return (0);
+
+	/* Give the pages back to the arena. */
+	if (mmap((void *)(uintptr_t)addr, npages * nix_page_size, PROT_NONE,
+			 MAP_ANON | MAP_PRIVATE | MAP_FIXED, -1, 0) == MAP_FAILED) {
+		nix_env_set_errno(env, errno);
+		return (-1);
+	}
+	bit_nclear(nix_arena_used, NIX_ARENA_PAGE(ga), NIX_ARENA_PAGE(ga) + npages - 1);
+
+	return (0);
 }
 
 int
@@ -102,9 +282,23 @@ nix_munlock (uintmax_t addr, size_t len, nix_env_t *env)
 int
 nix_msync (uintmax_t addr, size_t len, int flags, nix_env_t *env)
 {
+	int hflags = 0;
+
 	XEC_LOG(g_nix_log, XEC_LOG_DEBUG, 0, "addr=%llx, len=%08x, flags=%x", addr, len, flags);
 
-	return (nix_nosys(env));
+	if (flags & NIX_MS_ASYNC)
+		hflags |= MS_ASYNC;
+	if (flags & NIX_MS_SYNC)
+		hflags |= MS_SYNC;
+	if (flags & NIX_MS_INVALIDATE)
+		hflags |= MS_INVALIDATE;
+
+	if (msync((void *)(uintptr_t)addr, len, hflags) != 0) {
+		nix_env_set_errno(env, errno);
+		return (-1);
+	}
+
+	return (0);
 }
 
 int
@@ -128,7 +322,7 @@ nix_mprotect(uintmax_t addr, size_t len, int prot, nix_env_t *env)
 {
 	XEC_LOG(g_nix_log, XEC_LOG_DEBUG, 0, "addr=%llx, len=%08x, prot=%x", addr, len, prot);
 
-	if (mprotect ( (void *)(uintptr_t)addr, len, prot) != 0) { /*XXX*/
+	if (mprotect ( (void *)(uintptr_t)addr, len, nix_prot_to(prot)) != 0) {
 		nix_env_set_errno (env, errno);
 		return (-1);
 	}
@@ -21,4 +21,8 @@
 
 #define NIX_MAP_FLAGMASK	0x0593
 
+#define NIX_MS_ASYNC		0x0001
+#define NIX_MS_SYNC			0x0002
+#define NIX_MS_INVALIDATE	0x0004
+
 #endif /* !__nix_mem_h */
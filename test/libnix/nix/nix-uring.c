@@ -0,0 +1,271 @@
+#include "nix-config.h"
+
+#include <stddef.h>
+
+#include "nix.h"
+#include "nix-uring.h"
+
+/*
+ * Guest I/O through io_uring.
+ *
+ * Every request is queued on one ring and completes into a
+ * nix_uring_req_t on the caller's stack. While a request is
+ * outstanding, the wait hook lets the client run other guests or
+ * device work. Anything they submit joins the ring, so it goes out
+ * with the next submission. Whoever waits reaps every completion
+ * it sees, so a request can be done before its guest resumes.
+ */
+
+#ifdef HAVE_LIBURING
+
+#include <errno.h>
+#include <liburing.h>
+
+#include "xec-mem.h"
+#include "xec-debug.h"
+
+extern void *g_nix_log;
+
+#define NIX_URING_POLL_BATCH 32
+
+typedef struct _nix_uring_req {
+	int done;
+	int res;
+} nix_uring_req_t;
+
+static struct io_uring  nix_ring;
+static int              nix_ring_ready    = 0;
+static int            (*nix_wait_hook)(void *) = NULL;
+static void            *nix_wait_hook_arg = NULL;
+static int              nix_in_wait_hook  = 0;
+
+int
+nix_uring_init(unsigned entries)
+{
+	int rc;
+
+	if (nix_ring_ready)
+		return (1);
+
+	rc = io_uring_queue_init(entries, &nix_ring, 0);
+	if (rc < 0) {
+		XEC_LOG(g_nix_log, XEC_LOG_WARNING, 0, "io_uring unavailable, error=%d", -rc);
+		return (0);
+	}
+
+	nix_ring_ready = 1;
+	return (1);
+}
+
+void
+nix_uring_set_wait_hook(int (*hook)(void *), void *arg)
+{
+	nix_wait_hook     = hook;
+	nix_wait_hook_arg = arg;
+}
+
+static struct io_uring_sqe *
+nix_uring_get_sqe(void *data)
+{
+	struct io_uring_sqe *sqe;
+
+	/* Ring full, push out what is queued. */
+	while ((sqe = io_uring_get_sqe(&nix_ring)) == NULL)
+		io_uring_submit(&nix_ring);
+
+	io_uring_sqe_set_data(sqe, data);
+	return (sqe);
+}
+
+static void
+nix_uring_reap(struct io_uring_cqe *cqe)
+{
+	nix_uring_req_t *req = (nix_uring_req_t *)io_uring_cqe_get_data(cqe);
+
+	/* Cancellations carry no request. */
+	if (req != NULL) {
+		req->res  = cqe->res;
+		req->done = 1;
+	}
+	io_uring_cqe_seen(&nix_ring, cqe);
+}
+
+/* Submit the queue and wait until one of `reqs' has completed. */
+static void
+nix_uring_wait_any(nix_uring_req_t *reqs, size_t count)
+{
+	struct io_uring_cqe *cqe;
+	size_t               n;
+
+	io_uring_submit(&nix_ring);
+
+	for (;;) {
+		for (n = 0; n < count; n++)
+			if (reqs[n].done)
+				return;
+
+		if (io_uring_peek_cqe(&nix_ring, &cqe) == 0) {
+			nix_uring_reap(cqe);
+			continue;
+		}
+
+		/* Let the client do other work, but not from within itself. */
+		if (nix_wait_hook != NULL && !nix_in_wait_hook) {
+			int busy;
+
+			nix_in_wait_hook = 1;
+			busy = nix_wait_hook(nix_wait_hook_arg);
+			nix_in_wait_hook = 0;
+			if (busy)
+				continue;
+		}
+
+		if (io_uring_wait_cqe(&nix_ring, &cqe) == 0)
+			nix_uring_reap(cqe);
+	}
+}
+
+#define nix_uring_wait(req) nix_uring_wait_any(req, 1)
+
+static ssize_t
+nix_uring_result(nix_uring_req_t const *req)
+{
+	if (req->res < 0) {
+		errno = -req->res;
+		return (-1);
+	}
+	return (req->res);
+}
+
+ssize_t
+nix_uring_read(int fd, void *buf, size_t len)
+{
+	nix_uring_req_t req = { 0, 0 };
+
+	if (!nix_ring_ready)
+		return (read(fd, buf, len));
+
+	/* An offset of -1 reads at the file position. */
+	io_uring_prep_read(nix_uring_get_sqe(&req), fd, buf, len, (__u64)-1);
+	nix_uring_wait(&req);
+	return (nix_uring_result(&req));
+}
+
+ssize_t
+nix_uring_readv(int fd, struct iovec const *iov, int iovcnt)
+{
+	nix_uring_req_t req = { 0, 0 };
+
+	if (!nix_ring_ready)
+		return (readv(fd, iov, iovcnt));
+
+	io_uring_prep_readv(nix_uring_get_sqe(&req), fd, iov, iovcnt, (__u64)-1);
+	nix_uring_wait(&req);
+	return (nix_uring_result(&req));
+}
+
+ssize_t
+nix_uring_write(int fd, void const *buf, size_t len)
+{
+	nix_uring_req_t req = { 0, 0 };
+
+	if (!nix_ring_ready)
+		return (write(fd, buf, len));
+
+	io_uring_prep_write(nix_uring_get_sqe(&req), fd, buf, len, (__u64)-1);
+	nix_uring_wait(&req);
+	return (nix_uring_result(&req));
+}
+
+ssize_t
+nix_uring_writev(int fd, struct iovec const *iov, int iovcnt)
+{
+	nix_uring_req_t req = { 0, 0 };
+
+	if (!nix_ring_ready)
+		return (writev(fd, iov, iovcnt));
+
+	io_uring_prep_writev(nix_uring_get_sqe(&req), fd, iov, iovcnt, (__u64)-1);
+	nix_uring_wait(&req);
+	return (nix_uring_result(&req));
+}
+
+/*
+ * Wait on the ring until any descriptor is ready or the timeout
+ * expires, then get the exact revents with a poll that does not
+ * block.
+ */
+int
+nix_uring_poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+	nix_uring_req_t			 reqbuf[NIX_URING_POLL_BATCH + 1];
+	nix_uring_req_t			*reqs;
+	struct __kernel_timespec ts;
+	nfds_t					 n;
+
+	if (!nix_ring_ready || timeout == 0)
+		return (poll(fds, nfds, timeout));
+
+	if (nfds <= NIX_URING_POLL_BATCH)
+		reqs = reqbuf;
+	else {
+		reqs = xec_mem_alloc_ntype(nix_uring_req_t, nfds + 1, 0);
+		if (reqs == NULL)
+			return (poll(fds, nfds, timeout));
+	}
+
+	/* One poll per descriptor plus the timeout, in a single batch. */
+	for (n = 0; n < nfds; n++) {
+		reqs[n].done = reqs[n].res = 0;
+		if (fds[n].fd < 0)
+			continue;
+		io_uring_prep_poll_add(nix_uring_get_sqe(&reqs[n]), fds[n].fd,
+			(unsigned)fds[n].events | POLLERR | POLLHUP | POLLNVAL);
+	}
+	reqs[nfds].done = reqs[nfds].res = 0;
+	if (timeout > 0) {
+		ts.tv_sec  = timeout / 1000;
+		ts.tv_nsec = (timeout % 1000) * 1000000LL;
+		io_uring_prep_timeout(nix_uring_get_sqe(&reqs[nfds]), &ts, 0, 0);
+	}
+
+	/* Any completion of the set ends the wait. */
+	nix_uring_wait_any(reqs, nfds + 1);
+
+	/* Withdraw the rest; they complete with -ECANCELED. */
+	for (n = 0; n <= nfds; n++) {
+		if (reqs[n].done || (n < nfds && fds[n].fd < 0) ||
+			(n == nfds && timeout < 0))
+			continue;
+		io_uring_prep_cancel64(nix_uring_get_sqe(NULL),
+			(__u64)(uintptr_t)&reqs[n], 0);
+	}
+	for (n = 0; n <= nfds; n++) {
+		if ((n < nfds && fds[n].fd < 0) || (n == nfds && timeout < 0))
+			continue;
+		nix_uring_wait(&reqs[n]);
+	}
+
+	if (reqs != reqbuf)
+		xec_mem_free(reqs);
+
+	return (poll(fds, nfds, 0));
+}
+
+#else   /* !HAVE_LIBURING */
+
+int
+nix_uring_init(unsigned entries)
+{
+	(void)entries;
+	return (0);
+}
+
+void
+nix_uring_set_wait_hook(int (*hook)(void *), void *arg)
+{
+	(void)hook;
+	(void)arg;
+}
+
+#endif  /* HAVE_LIBURING */
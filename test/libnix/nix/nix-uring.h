@@ -0,0 +1,43 @@
+#ifndef __nix_uring_h
+#define __nix_uring_h
+
+#include "nix-config.h"
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <unistd.h>
+
+/*
+ * Host I/O for the guest, through io_uring when nix_uring_init()
+ * succeeded, or the plain system calls otherwise.
+ * Same return values and errno as the system calls.
+ */
+#ifdef HAVE_LIBURING
+
+ssize_t
+nix_uring_read(int fd, void *buf, size_t len);
+
+ssize_t
+nix_uring_readv(int fd, struct iovec const *iov, int iovcnt);
+
+ssize_t
+nix_uring_write(int fd, void const *buf, size_t len);
+
+ssize_t
+nix_uring_writev(int fd, struct iovec const *iov, int iovcnt);
+
+int
+nix_uring_poll(struct pollfd *fds, nfds_t nfds, int timeout);
+
+#else
+
+#define nix_uring_read   read
+#define nix_uring_readv  readv
+#define nix_uring_write  write
+#define nix_uring_writev writev
+#define nix_uring_poll   poll
+
+#endif  /* HAVE_LIBURING */
+
+#endif  /* !__nix_uring_h */
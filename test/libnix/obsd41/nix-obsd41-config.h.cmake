@@ -2,3 +2,5 @@
 #cmakedefine HAVE_SYS_SYSCTL_H 1
 #cmakedefine HAVE_LINUX_SYSCTL_H 1
 
+#cmakedefine HAVE_HOST_IOVEC32 1
+
@@ -0,0 +1,36 @@
+#ifndef __obsd41_layout_h
+#define __obsd41_layout_h
+
+#include "nix-obsd41-config.h"
+#include "xec-base.h"
+
+/*
+ * Guest structures whose host (nix) counterpart has the same layout,
+ * as found by the configure checks. When the guest also runs with the
+ * host byte order, such structures can be handed to nix as they are.
+ */
+#define OBSD41_LAYOUT_IOVEC32 0x0001
+
+#ifdef HAVE_HOST_IOVEC32
+#define OBSD41_HOST_IOVEC32 OBSD41_LAYOUT_IOVEC32
+#else
+#define OBSD41_HOST_IOVEC32 0
+#endif
+
+#define OBSD41_HOST_LAYOUTS (OBSD41_HOST_IOVEC32)
+
+static __inline int
+obsd41_layout_native(xec_guest_info_t const *gi, unsigned layout)
+{
+	return ((OBSD41_HOST_LAYOUTS & layout) == layout &&
+			gi->endian == XEC_ENDIAN_NATIVE);
+}
+
+/*
+ * Number of elements converted on the stack before falling back to
+ * a heap allocation.
+ */
+#define OBSD41_IOV_BATCH  16
+#define OBSD41_POLL_BATCH 32
+
+#endif  /* !__obsd41_layout_h */
@@ -24,6 +24,7 @@
 #include "obsd41-args.h"
 #include "obsd41-sysctl.h"
 #include "obsd41-mman.h"
+#include "obsd41-layout.h"
 
 #include "xec-mmap.h" /* XXX */
 
@@ -35,21 +36,50 @@
 
 void *g_bsd_log = NULL;
 
+/*
+ * Convert a guest iovec array for nix. If the guest array already has
+ * the host layout and byte order, and all the buffers are mapped 1:1,
+ * it is returned as is; otherwise the conversion goes to `buf' when
+ * it has room for `niov' entries, or to the heap.
+ * Release the result with __obsd41_iovec32_release.
+ */
 static __inline struct nix_iovec *
 __obsd41_iovec32_copy_from(nix_env_t				*env,
 						   xec_mem_if_t				*mem,
 						   xec_guest_info_t const	*gi,
 						   struct obsd41_iovec32	*iov,
-						   size_t					 niov)
+						   size_t					 niov,
+						   struct nix_iovec			*buf,
+						   size_t					 nbuf)
 {
 	struct nix_iovec *xiov = NULL;
 
 	__nix_try
 	{
-		xiov = xec_mem_alloc_ntype(struct nix_iovec, niov, 0);
+		if (obsd41_layout_native(gi, OBSD41_LAYOUT_IOVEC32)) {
+			size_t n;
+
+			for (n = 0; n < niov; n++) {
+				xec_mem_flg_t mf = 0;
+
+				if (xec_mem_gtoh(mem, iov[n].iov_base, &mf) != iov[n].iov_base ||
+					mf != 0)
+					break;
+			}
+			if (n == niov)
+				xiov = (struct nix_iovec *)iov;
+		}
+
+		if (xiov == NULL) {
+			if (niov <= nbuf)
+				xiov = buf;
+			else
+				xiov = xec_mem_alloc_ntype(struct nix_iovec, niov, 0);
+		}
+
 		if (xiov == NULL)
 			nix_env_set_errno(env, ENOMEM);
-		else {
+		else if (xiov != (struct nix_iovec *)iov) {
 			size_t n;
 
 			for (n = 0; n < niov; n++) {
@@ -59,7 +89,8 @@ __obsd41_iovec32_copy_from(nix_env_t				*env,
 				pa = xec_mem_gtoh(mem, GE32(gi, iov[n].iov_base), &mf);
 				if (mf != 0) {
 					nix_env_set_errno(env, EFAULT);
-					xec_mem_free(xiov);
+					if (xiov != buf)
+						xec_mem_free(xiov);
 					xiov = NULL;
 					break;
 				}
@@ -71,7 +102,7 @@ __obsd41_iovec32_copy_from(nix_env_t				*env,
 	__nix_catch_any
 	{
 		nix_env_set_errno(env, EFAULT);
-		if (xiov != NULL)
+		if (xiov != NULL && xiov != buf && xiov != (struct nix_iovec *)iov)
 			xec_mem_free(xiov);
 		xiov = NULL;
 	}
@@ -80,17 +111,36 @@ __obsd41_iovec32_copy_from(nix_env_t				*env,
 	return (xiov);
 }
 
+static __inline void
+__obsd41_iovec32_release(struct nix_iovec		*xiov,
+						 struct obsd41_iovec32	*iov,
+						 struct nix_iovec		*buf)
+{
+	if (xiov != buf && xiov != (struct nix_iovec *)iov)
+		xec_mem_free(xiov);
+}
+
+/*
+ * Convert a guest pollfd array for nix, into `buf' when it has room
+ * for `nfds' entries, or to the heap otherwise. Descriptors are
+ * mapped by nix_poll, so the array is always converted.
+ */
 static __inline struct nix_pollfd *
 __obsd41_pollfd_copy_from(nix_env_t				 *env,
 						  xec_guest_info_t const *gi,
 						  struct obsd41_pollfd	 *fds,
-						  size_t				  nfds)
+						  size_t				  nfds,
+						  struct nix_pollfd		 *buf,
+						  size_t				  nbuf)
 {
 	struct nix_pollfd *xfds = NULL;
 
 	__nix_try
 	{
-		xfds = xec_mem_alloc_ntype(struct nix_pollfd, nfds, 0);
+		if (nfds <= nbuf)
+			xfds = buf;
+		else
+			xfds = xec_mem_alloc_ntype(struct nix_pollfd, nfds, 0);
 		if (xfds == NULL)
 			nix_env_set_errno(env, ENOMEM);
 		else {
@@ -103,7 +153,7 @@ __obsd41_pollfd_copy_from(nix_env_t				 *env,
 	__nix_catch_any
 	{
 		nix_env_set_errno(env, EFAULT);
-		if (xfds != NULL)
+		if (xfds != NULL && xfds != buf)
 			xec_mem_free(xfds);
 		xfds = NULL;
 	}
@@ -2143,6 +2193,7 @@ int obsd41_readv(
 {
 	xec_guest_info_t  gi;
 	struct nix_iovec *xiov;
+	struct nix_iovec  iovbuf[OBSD41_IOV_BATCH];
 	nix_env_t		 *env = obsd41_us_syscall_get_nix_env(xus);
 	xec_mem_if_t	 *mem = xec_monitor_get_memory (xmon);
 
@@ -2155,10 +2206,11 @@ int obsd41_readv(
 	gi.endian = XEC_ENDIAN_BIG;
 #endif
 
-	xiov = __obsd41_iovec32_copy_from(env, mem, &gi, args->arg1, args->arg2);
+	xiov = __obsd41_iovec32_copy_from(env, mem, &gi, args->arg1, args->arg2,
+									  iovbuf, OBSD41_IOV_BATCH);
 	if (xiov != NULL) {
 		*result = nix_readv (args->arg0, xiov, args->arg2, env);
-		xec_mem_free(xiov);
+		__obsd41_iovec32_release(xiov, args->arg1, iovbuf);
 	}
 
 	return (nix_env_get_errno(env));
@@ -2172,6 +2224,7 @@ int obsd41_writev(
 {
 	xec_guest_info_t  gi;
 	struct nix_iovec *xiov;
+	struct nix_iovec  iovbuf[OBSD41_IOV_BATCH];
 	nix_env_t		 *env = obsd41_us_syscall_get_nix_env(xus);
 	xec_mem_if_t	 *mem = xec_monitor_get_memory (xmon);
 
@@ -2179,10 +2232,11 @@ int obsd41_writev(
 
 	xec_monitor_get_guest_info(xmon, &gi);
 
-	xiov = __obsd41_iovec32_copy_from(env, mem, &gi, args->arg1, args->arg2);
+	xiov = __obsd41_iovec32_copy_from(env, mem, &gi, args->arg1, args->arg2,
+									  iovbuf, OBSD41_IOV_BATCH);
 	if (xiov != NULL) {
 		*result = nix_writev(args->arg0, xiov, args->arg2, env);
-		xec_mem_free(xiov);
+		__obsd41_iovec32_release(xiov, args->arg1, iovbuf);
 	}
 
 	return (nix_env_get_errno(env));
@@ -3102,8 +3156,9 @@ int obsd41_mmap(
 	flags = args->arg3 & NIX_MAP_FLAGMASK;
 	nix_env_set_errno(env, 0);
 
+	/* arg5 is the padding before the offset */
 	*result = (uintptr_t)nix_mmap(args->arg0, args->arg1, prot, flags,
-								  args->arg4, args->arg5, env);
+								  args->arg4, args->arg6, env);
 	XEC_LOG(g_bsd_log, XEC_LOG_DEBUG, 0, "%x,%x -> %x,%x - res = %x",
 			args->arg2, args->arg3, prot, flags, *result); 
 
@@ -3766,6 +3821,7 @@ int obsd41_poll(
 	xec_guest_info_t	  gi;
 	struct obsd41_pollfd *ofds = args->arg0;
 	struct nix_pollfd	 *fds = NULL;
+	struct nix_pollfd	  fdsbuf[OBSD41_POLL_BATCH];
 	nix_env_t			 *env = obsd41_us_syscall_get_nix_env(xus);
 
 	XEC_LOG(g_bsd_log, XEC_LOG_DEBUG, 0, "invoked", 0);
@@ -3773,7 +3829,8 @@ int obsd41_poll(
 	xec_monitor_get_guest_info(xmon, &gi);
 
 	nix_env_set_errno(env, 0);
-	fds = __obsd41_pollfd_copy_from(env, &gi, ofds, args->arg1);
+	fds = __obsd41_pollfd_copy_from(env, &gi, ofds, args->arg1,
+								   fdsbuf, OBSD41_POLL_BATCH);
 	if (fds != NULL) {
 		*result = nix_poll(fds, args->arg1, args->arg2, env);
 
@@ -3794,7 +3851,8 @@ int obsd41_poll(
 			__nix_end_try
 		}
 
-		xec_mem_free(fds);
+		if (fds != fdsbuf)
+			xec_mem_free(fds);
 	} else {
 		*result = -1;
 	}
@@ -15,6 +15,19 @@ static void *g_ldr_log = NULL;
 struct coff_aouthdr g_ahdr;
 aout_header_t       g_exec;
 
+/* a.out symbol table (struct nlist, big endian) and string table */
+#define NLIST_SIZE 12
+
+/* maps file contents into guest memory instead of copying them */
+static loader_map_t g_map = NULL;
+static void        *g_map_arg = NULL;
+static char const  *g_path = NULL;
+
+static uint8_t *g_syms = NULL;
+static size_t   g_syms_size = 0;
+static char    *g_strs = NULL;
+static size_t   g_strs_size = 0;
+
 static int
 mapin(xec_mem_if_t *mem_if, xec_mmap_t *mm, aout_header_t const *ah)
 {
@@ -32,6 +45,11 @@ mapin(xec_mem_if_t *mem_if, xec_mmap_t *mm, aout_header_t const *ah)
 
 	bytes = xec_mmap_get_bytes(mm);
 
+	if (g_map != NULL &&
+		g_map(g_map_arg, g_path, 0, g_ahdr.tstart, ah->a_text) == 0 &&
+		g_map(g_map_arg, g_path, ah->a_text, g_ahdr.dstart, ah->a_data) == 0)
+		return LOADER_SUCCESS;
+
 	mf = 0;
 	text = (void *)xec_mem_gtoh(mem_if, g_ahdr.tstart, &mf);
 	if (mf != 0) return LOADER_INVALID_ADDRESS;
@@ -95,6 +113,33 @@ aout_swap(aout_header_t const *in,
 	out->a_drsize = xec_byte_swap_big_to_host32(in->a_drsize);
 }
 
+static void
+aout_copy_symbols(xec_mmap_t *mm, aout_header_t const *ah)
+{
+	uint8_t const *bytes = (uint8_t const *)xec_mmap_get_bytes(mm);
+	size_t         size = xec_mmap_get_size(mm);
+	size_t         symoff = N_SYMOFF(*ah);
+	size_t         stroff = N_STROFF(*ah);
+
+	if (ah->a_syms == 0 || stroff + 4 > size)
+		return;
+
+	g_strs_size = xec_byte_swap_big_to_host32(*(uint32_t const *)(bytes + stroff));
+	if (stroff + g_strs_size > size)
+		return;
+
+	g_syms = (uint8_t *)malloc(ah->a_syms);
+	g_strs = (char *)malloc(g_strs_size);
+	if (g_syms == NULL || g_strs == NULL)
+		return;
+
+	memcpy(g_syms, bytes + symoff, ah->a_syms);
+	memcpy(g_strs, bytes + stroff, g_strs_size);
+	g_syms_size = ah->a_syms;
+
+	XEC_LOG(g_ldr_log, XEC_LOG_INFO, 0, "  symbols     = %lu", (unsigned long)(g_syms_size / NLIST_SIZE));
+}
+
 static int
 aout_process(xec_mem_if_t *mem_if, xec_mmap_t *mm, aout_header_t const *ah)
 {
@@ -112,8 +157,10 @@ aout_process(xec_mem_if_t *mem_if, xec_mmap_t *mm, aout_header_t const *ah)
 	pc = sah.a_entry;
 
 	rc = mapin(mem_if, mm, &sah);
-	if (rc == 0)
+	if (rc == 0) {
 		memcpy(&g_exec, &sah, sizeof (sah));
+		aout_copy_symbols(mm, &sah);
+	}
 
 	return rc;
 }
@@ -175,6 +222,7 @@ loader_load(xec_mem_if_t *mem_if, char const *path)
 	}
 
 	XEC_LOG(g_ldr_log, XEC_LOG_INFO, 0, "Opened file `%s'", path);
+	g_path = path;
 	XEC_LOG(g_ldr_log, XEC_LOG_INFO, 0, "  Base Pointer = %p", xec_mmap_get_bytes(mm));
 	XEC_LOG(g_ldr_log, XEC_LOG_INFO, 0, "  Size         = %lu", (unsigned long)xec_mmap_get_size(mm));
 
@@ -197,3 +245,29 @@ loader_load(xec_mem_if_t *mem_if, char const *path)
 
 	return rc;
 }
+
+void
+loader_set_map_function(loader_map_t map, void *arg)
+{
+	g_map = map;
+	g_map_arg = arg;
+}
+
+int
+loader_lookup_symbol(char const *name, uint32_t *value)
+{
+	size_t n;
+
+	for (n = 0; n + NLIST_SIZE <= g_syms_size; n += NLIST_SIZE) {
+		uint32_t strx = xec_byte_swap_big_to_host32(*(uint32_t const *)(g_syms + n));
+
+		if (strx < 4 || strx >= g_strs_size)
+			continue;
+		if (strncmp(g_strs + strx, name, g_strs_size - strx) == 0) {
+			*value = xec_byte_swap_big_to_host32(*(uint32_t const *)(g_syms + n + 8));
+			return 1;
+		}
+	}
+
+	return 0;
+}
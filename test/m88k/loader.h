@@ -24,6 +24,21 @@ loader_init(void);
 int
 loader_load(xec_mem_if_t *mem_if, char const *path);
 
+/*
+ * Maps `size' bytes at `offset' of the file `path' to the guest
+ * address `addr', returns 0 on success. Without one, or if it
+ * fails, the loader copies the segments.
+ */
+typedef int (*loader_map_t)(void *arg, char const *path, uint64_t offset,
+							uint32_t addr, size_t size);
+
+void
+loader_set_map_function(loader_map_t map, void *arg);
+
+/* returns 1 and the value of the a.out symbol, or 0 */
+int
+loader_lookup_symbol(char const *name, uint32_t *value);
+
 #ifdef __cplusplus
 }
 #endif
@@ -190,7 +190,6 @@ main(int argc, char **argv)
 	char *entries;
 	cpu_t *cpu;
 	uint8_t *RAM;
-	FILE *f;
 	int ramsize;
 	char *stack;
 	int i;
@@ -203,7 +202,7 @@ main(int argc, char **argv)
 	int step = 0;
 #endif
 	ramsize = 5*1024*1024;
-	RAM = (uint8_t*)malloc(ramsize);
+	RAM = cpu_alloc_ram(ramsize);
 
 	cpu = cpu_new(CPU_ARCH_M88K, CPU_FLAG_ENDIAN_BIG, 0);
 
@@ -245,13 +244,13 @@ main(int argc, char **argv)
 #endif
 
 	/* load code */
-	if (!(f = fopen(executable, "rb"))) {
+	cpu->code_start = START;
+	int64_t size = cpu_map_image(cpu, executable, 0, cpu->code_start, ramsize-cpu->code_start);
+	if (size < 0) {
 		printf("Could not open %s!\n", executable);
 		return 2;
 	}
-	cpu->code_start = START;
-	cpu->code_end = cpu->code_start + fread(&RAM[cpu->code_start], 1, ramsize-cpu->code_start, f);
-	fclose(f);
+	cpu->code_end = cpu->code_start + size;
 	cpu->code_entry = cpu->code_start + ENTRY;
 
 	cpu_tag(cpu, cpu->code_entry);
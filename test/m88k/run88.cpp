@@ -14,6 +14,8 @@
 //#define DEBUGGER
 
 #define RAM_SIZE (16 * 1024 * 1024)
+/* guest mmap()s go right above RAM */
+#define MMAP_SIZE (256 * 1024 * 1024)
 #define STACK_TOP ((long long)(RAM+RAM_SIZE-4))
 
 #define PC (((m88k_grf_t*)cpu->rf.grf)->sxip)
@@ -214,6 +216,22 @@ debug_function(cpu_t *cpu)
 	fprintf(stderr, "%s:%u [trap %u]\n", __FILE__, __LINE__, R[13]);
 }
 
+static xec_monitor_t *monitor;
+static xec_us_syscall_if_t *us_syscall;
+
+/* system call arguments in r2-r9 and on the stack, number in r13 */
+#define SYSCALL_GPR_MASK (0x3FCULL | (1ULL << 13) | (1ULL << 31))
+
+static int
+trap_function(cpu_t *cpu)
+{
+	if (TRAPNO == 0x80 && R[13] == 1) // exit
+		return CPU_TRAP_EXIT;
+
+	xec_us_syscall_dispatch(us_syscall, monitor);
+	return CPU_TRAP_RESUME;
+}
+
 static void
 dump_state(uint8_t *RAM, m88k_grf_t *reg)
 {
@@ -262,12 +280,20 @@ void
 aspace_unlock(void)
 {
 #ifdef __x86_64__
-	/* Unmap as much as possible. */
-	munmap((void*)RAM_SIZE, 0x100000000 - RAM_SIZE);
+	/* Unmap as much as possible, but keep the mmap arena. */
+	munmap((void*)(RAM_SIZE + MMAP_SIZE), 0x100000000 - RAM_SIZE - MMAP_SIZE);
 #endif
 }
 
 
+static int
+map_image(void *arg, char const *path, uint64_t offset, uint32_t addr, size_t size)
+{
+	if (addr >= RAM_SIZE || size > RAM_SIZE - addr)
+		return -1;
+	return cpu_map_image((cpu_t *)arg, path, offset, addr, size) == (int64_t)size ? 0 : -1;
+}
+
 int
 main(int ac, char **av, char **ep)
 {
@@ -275,8 +301,6 @@ main(int ac, char **av, char **ep)
 	cpu_t *cpu;
 	xec_guest_info_t guest_info;
 	xec_mem_if_t *mem_if;
-	xec_monitor_t *monitor;
-	xec_us_syscall_if_t *us_syscall;
 	m88k_uintptr_t stack_top;
 	nix_env_t *env;
 	bool debugging = false;
@@ -293,6 +317,9 @@ main(int ac, char **av, char **ep)
 	obsd41_init();
 	loader_init();
 
+	/* Guest I/O through io_uring, if the host has it */
+	nix_uring_init(64);
+
 	/* Create CPU */
 	cpu = cpu_new(CPU_ARCH_M88K, CPU_FLAG_ENDIAN_BIG, 0);
 	if (cpu == NULL) {
@@ -317,7 +344,17 @@ main(int ac, char **av, char **ep)
 		exit(EXIT_FAILURE);
 	}
 
-	/* Load the executable */
+#ifdef __x86_64__
+	/* Map guest mmap()s, including files, into the reserved space */
+	if (!nix_mmap_arena(RAM_SIZE, MMAP_SIZE, env)) {
+		fprintf(stderr, "error: failed reserving the mmap arena.\n");
+		exit(EXIT_FAILURE);
+	}
+#endif
+
+	/* Load the executable, mapping its pages into RAM */
+	cpu_set_ram(cpu, RAM);
+	loader_set_map_function(map_image, cpu);
 	rc = loader_load(mem_if, av[1]);
 	if (rc != LOADER_SUCCESS) {
 		fprintf(stderr, "error: cannot load executable '%s', error=%d.\n", av[1], rc);
@@ -341,7 +378,6 @@ main(int ac, char **av, char **ep)
 	cpu_set_flags_debug(cpu, CPU_DEBUG_NONE);
 	//cpu_set_flags_debug(cpu, CPU_DEBUG_SINGLESTEP_BB);
 	cpu_set_flags_hint(cpu, CPU_HINT_TRAP_RETURNS_TWICE);
-	cpu_set_ram(cpu, RAM);
 
 	/* Create XEC bridge monitor */
 	guest_info.name = cpu->info.name;
@@ -356,6 +392,18 @@ main(int ac, char **av, char **ep)
 		exit(EXIT_FAILURE);
 	}
 
+	/* Run the string routines of libc natively, on RAM and the mmap arena */
+	cpu_set_ram_size(cpu, RAM_SIZE + MMAP_SIZE);
+	static char const *const libc_symbols[] = { "_memcpy", "_memset", "_strlen", "_bcopy" };
+	for (size_t i = 0; i < sizeof(libc_symbols) / sizeof(libc_symbols[0]); i++) {
+		uint32_t addr;
+		if (loader_lookup_symbol(libc_symbols[i], &addr))
+			cpu_hook_libc(cpu, libc_symbols[i], addr);
+	}
+
+	/* Handle system calls without leaving the translated code */
+	cpu_set_trap_function(cpu, trap_function, SYSCALL_GPR_MASK);
+
 	/* Setup registers for execution */
 	PC = g_ahdr.entry;
 
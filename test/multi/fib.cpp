@@ -47,7 +47,6 @@ main(int argc, char **argv)
 	cpu_arch_t arch;
 	cpu_t *cpu;
 	uint8_t *RAM;
-	FILE *f;
 	int ramsize;
 	int r1, r2;
 	uint64_t t1, t2, t3, t4;
@@ -56,10 +55,23 @@ main(int argc, char **argv)
 	int singlestep = SINGLESTEP_NONE;
 	int log = 1;
 	int print_ir = 1;
+	int report = 0;
+	int fuse = 1;
 
 	/* parameter parsing */
+	while (argc >= 2 && argv[1][0] == '-') {
+		if (!strcmp(argv[1], "-nofuse")) /* compare without idioms */
+			fuse = 0;
+		else if (!strcmp(argv[1], "-report")) /* translation report */
+			report = 1;
+		else
+			break;
+		argv[1] = argv[0];
+		argc--;
+		argv++;
+	}
 	if (argc < 3) {
-		printf("Usage: %s executable [arch] [itercount] [entries]\n", argv[0]);
+		printf("Usage: %s [-nofuse] [-report] executable [arch] [itercount] [entries]\n", argv[0]);
 		return 0;
 	}
 	s_arch = argv[1];
@@ -80,15 +92,19 @@ main(int argc, char **argv)
 	}
 
 	ramsize = 5*1024*1024;
-	RAM = (uint8_t*)malloc(ramsize);
+	RAM = cpu_alloc_ram(ramsize);
 
 	cpu = cpu_new(arch, 0, 0);
 
-	cpu_set_flags_codegen(cpu, CPU_CODEGEN_OPTIMIZE);
+	cpu_set_flags_codegen(cpu, CPU_CODEGEN_OPTIMIZE
+		| CPU_CODEGEN_LOOPS
+		| (fuse? CPU_CODEGEN_FUSE : 0)
+		);
 	cpu_set_flags_debug(cpu, 0
 		| (print_ir? CPU_DEBUG_PRINT_IR : 0)
 		| (print_ir? CPU_DEBUG_PRINT_IR_OPTIMIZED : 0)
 		| (log? CPU_DEBUG_LOG :0)
+		| (report? CPU_DEBUG_REPORT : 0)
 		| (singlestep == SINGLESTEP_STEP? CPU_DEBUG_SINGLESTEP    : 0)
 		| (singlestep == SINGLESTEP_BB?   CPU_DEBUG_SINGLESTEP_BB : 0)
 		);
@@ -96,13 +112,13 @@ main(int argc, char **argv)
 	cpu_set_ram(cpu, RAM);
 	
 	/* load code */
-	if (!(f = fopen(executable, "rb"))) {
+	cpu->code_start = START;
+	int64_t size = cpu_map_image(cpu, executable, 0, cpu->code_start, ramsize-cpu->code_start);
+	if (size < 0) {
 		printf("Could not open %s!\n", executable);
 		return 2;
 	}
-	cpu->code_start = START;
-	cpu->code_end = cpu->code_start + fread(&RAM[cpu->code_start], 1, ramsize-cpu->code_start, f);
-	fclose(f);
+	cpu->code_end = cpu->code_start + size;
 	cpu->code_entry = cpu->code_start + ENTRY;
 
 	cpu_tag(cpu, cpu->code_entry);
@@ -163,6 +179,9 @@ main(int argc, char **argv)
 	t4 = abs_time();
 	printf("done!\n");
 
+	if (report)
+		cpu_print_translation_report(cpu);
+
   cpu_free(cpu);
 
 	printf("Time GUEST: %lld\n", t2-t1);
@@ -0,0 +1,163 @@
+/*
+ * runs N MIPS cpus in N host threads on one RAM; every cpu increments
+ * a shared counter with ll/sc. Checks that no increment got lost and
+ * compares the throughput with a single cpu.
+ */
+#include "timings.h"
+
+#include <pthread.h>
+
+#include <libcpu.h>
+#include "arch/mips/mips_interface.h"
+
+#define RET_MAGIC 0x4D495354
+#define RAM_SIZE (64*1024)
+#define COUNTER 0x1000
+#define ITERATIONS 1000000
+#define MAX_THREADS 64
+
+/* a0: iterations, a1: counter address */
+static uint32_t const code[] = {
+	0xC0A80000,	/* loop:	ll	t0, 0(a1)	*/
+	0x25080001,	/*		addiu	t0, t0, 1	*/
+	0xE0A80000,	/*		sc	t0, 0(a1)	*/
+	0x1100FFFC,	/*		beqz	t0, loop	*/
+	0x00000000,	/*		nop			*/
+	0x2484FFFF,	/*		addiu	a0, a0, -1	*/
+	0x1480FFF9,	/*		bnez	a0, loop	*/
+	0x00000000,	/*		nop			*/
+	0x03E00008,	/*		jr	ra		*/
+	0x00000000	/*		nop			*/
+};
+
+typedef struct {
+	uint8_t *RAM;
+	unsigned iterations;
+	uint32_t flags_codegen;
+	pthread_t thread;
+	bool ok;
+} guest_t;
+
+static void
+debug_function(cpu_t *cpu) {
+	fprintf(stderr, "%s:%u\n", __FILE__, __LINE__);
+}
+
+static void *
+run_guest(void *arg)
+{
+	guest_t *g = (guest_t *)arg;
+	cpu_t *cpu = cpu_new(CPU_ARCH_MIPS, CPU_FLAG_ENDIAN_BIG, CPU_MIPS_IS_32BIT);
+	reg_mips32_t *reg;
+
+	cpu_set_flags_codegen(cpu, g->flags_codegen);
+	cpu_set_flags_debug(cpu, CPU_DEBUG_NONE);
+	cpu_set_ram(cpu, g->RAM);
+	cpu->code_start = 0;
+	cpu->code_end = sizeof(code);
+	cpu->code_entry = 0;
+
+	cpu_tag(cpu, cpu->code_entry);
+	cpu_translate(cpu);
+
+	reg = (reg_mips32_t *)cpu->rf.grf;
+	reg->pc = cpu->code_entry;
+	reg->r[4] = g->iterations;
+	reg->r[5] = COUNTER;
+	reg->r[31] = RET_MAGIC;
+
+	cpu_run(cpu, debug_function);
+	g->ok = reg->pc == RET_MAGIC;
+
+	cpu_free(cpu);
+	return NULL;
+}
+
+static uint32_t
+get32be(uint8_t *p)
+{
+	return p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static void
+put32be(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+/* runs `count' cpus on RAM, returns the wall clock time */
+static uint64_t
+run_guests(uint8_t *RAM, guest_t *guests, int count, bool *ok)
+{
+	put32be(RAM + COUNTER, 0);
+
+	uint64_t t1 = abs_time();
+	for (int i = 0; i < count; i++)
+		pthread_create(&guests[i].thread, NULL, run_guest, &guests[i]);
+	for (int i = 0; i < count; i++)
+		pthread_join(guests[i].thread, NULL);
+	uint64_t t2 = abs_time();
+
+	uint32_t expected = 0;
+	for (int i = 0; i < count; i++) {
+		*ok &= guests[i].ok;
+		expected += guests[i].iterations;
+	}
+	uint32_t counter = get32be(RAM + COUNTER);
+	if (counter != expected) {
+		printf("counter is %u, expected %u\n", counter, expected);
+		*ok = false;
+	}
+	return t2 - t1;
+}
+
+int
+main(int argc, char **argv)
+{
+	guest_t guests[MAX_THREADS];
+	int threads = 4;
+	unsigned iterations = ITERATIONS;
+	uint32_t flags_codegen = CPU_CODEGEN_OPTIMIZE;
+
+	if (argc >= 2)
+		threads = atoi(argv[1]);
+	if (threads < 1 || threads > MAX_THREADS) {
+		printf("Usage: %s [threads] [iterations] [share]\n", argv[0]);
+		return 1;
+	}
+	if (argc >= 3)
+		iterations = atoi(argv[2]);
+	if (argc >= 4 && !strcmp("share", argv[3]))
+		flags_codegen |= CPU_CODEGEN_SHARE;
+
+	uint8_t *RAM = cpu_alloc_ram(RAM_SIZE);
+	for (size_t i = 0; i < sizeof(code)/sizeof(*code); i++)
+		put32be(RAM + i * 4, code[i]);
+
+	for (int i = 0; i < threads; i++) {
+		guests[i].RAM = RAM;
+		guests[i].iterations = iterations;
+		guests[i].flags_codegen = flags_codegen;
+	}
+
+	bool ok = true;
+	printf("1 cpu..."); fflush(stdout);
+	uint64_t t1 = run_guests(RAM, guests, 1, &ok);
+	printf("%lld\n", t1);
+	printf("%d cpus on one RAM...", threads); fflush(stdout);
+	uint64_t tn = run_guests(RAM, guests, threads, &ok);
+	printf("%lld\n", tn);
+
+	printf("increments per time unit: 1 cpu %.2f, %d cpus %.2f\n",
+		(float)iterations / t1, threads, (float)iterations * threads / tn);
+	if (ok)
+		printf("\033[1mSUCCESS!\033[22m\n\n");
+	else
+		printf("\033[1mFAILED!\033[22m\n\n");
+
+	cpu_free_ram(RAM, RAM_SIZE);
+	return ok ? 0 : 1;
+}
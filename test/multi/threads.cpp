@@ -0,0 +1,198 @@
+/*
+ * runs the same fib guest on N cpus in N host threads, and compares
+ * the throughput with a single cpu
+ */
+#define START 0
+#define ENTRY 0
+
+#include "timings.h"
+
+#define START_NO 100000000
+
+#include <pthread.h>
+
+#include <libcpu.h>
+#include "arch/arm/arm_types.h"
+#include "arch/m88k/m88k_isa.h"
+
+#define RET_MAGIC 0x4D495354
+#define RAM_SIZE (5*1024*1024)
+#define MAX_THREADS 64
+
+typedef struct {
+	cpu_arch_t arch;
+	char const *executable;
+	unsigned start_no;
+	uint32_t flags_codegen;
+	pthread_t thread;
+	int result;
+	bool ok;
+} guest_t;
+
+static void
+debug_function(cpu_t *cpu) {
+	fprintf(stderr, "%s:%u\n", __FILE__, __LINE__);
+}
+
+static int
+fib(int n)
+{
+	int f2=0;
+	int f1=1;
+	int fib=0;
+	int i;
+
+	if (n==0 || n==1)
+		return n;
+	for(i=2;i<=n;i++){
+		fib=f1+f2;
+		f2=f1;
+		f1=fib;
+	}
+	return fib;
+}
+
+static void *
+run_guest(void *arg)
+{
+	guest_t *g = (guest_t *)arg;
+	uint32_t *reg_pc, *reg_lr, *reg_param, *reg_result;
+
+	g->ok = false;
+
+	uint8_t *RAM = cpu_alloc_ram(RAM_SIZE);
+	cpu_t *cpu = cpu_new(g->arch, 0, 0);
+	cpu_set_flags_codegen(cpu, g->flags_codegen);
+	cpu_set_flags_debug(cpu, CPU_DEBUG_NONE);
+	cpu_set_ram(cpu, RAM);
+
+	cpu->code_start = START;
+	int64_t size = cpu_map_image(cpu, g->executable, 0, cpu->code_start, RAM_SIZE-cpu->code_start);
+	if (size < 0) {
+		printf("Could not open %s!\n", g->executable);
+		goto out;
+	}
+	cpu->code_end = cpu->code_start + size;
+	cpu->code_entry = cpu->code_start + ENTRY;
+
+	switch (g->arch) {
+		case CPU_ARCH_M88K:
+			reg_pc = &((m88k_grf_t*)cpu->rf.grf)->sxip;
+			reg_lr = &((m88k_grf_t*)cpu->rf.grf)->r[1];
+			reg_param = &((m88k_grf_t*)cpu->rf.grf)->r[2];
+			reg_result = &((m88k_grf_t*)cpu->rf.grf)->r[2];
+			break;
+		case CPU_ARCH_MIPS:
+			reg_pc = &((reg_mips32_t*)cpu->rf.grf)->pc;
+			reg_lr = &((reg_mips32_t*)cpu->rf.grf)->r[31];
+			reg_param = &((reg_mips32_t*)cpu->rf.grf)->r[4];
+			reg_result = &((reg_mips32_t*)cpu->rf.grf)->r[4];
+			break;
+		case CPU_ARCH_ARM:
+			reg_pc = &((reg_arm_t*)cpu->rf.grf)->pc;
+			reg_lr = &((reg_arm_t*)cpu->rf.grf)->r[14];
+			reg_param = &((reg_arm_t*)cpu->rf.grf)->r[0];
+			reg_result = &((reg_arm_t*)cpu->rf.grf)->r[0];
+			break;
+		default:
+			fprintf(stderr, "architecture %u not handled.\n", g->arch);
+			goto out;
+	}
+
+	cpu_tag(cpu, cpu->code_entry);
+	cpu_translate(cpu);
+
+	*reg_pc = cpu->code_entry;
+	*reg_lr = RET_MAGIC;
+	*reg_param = g->start_no;
+
+	cpu_run(cpu, debug_function);
+	g->result = *reg_result;
+	g->ok = true;
+
+out:
+	cpu_free(cpu);
+	cpu_free_ram(RAM, RAM_SIZE);
+	return NULL;
+}
+
+/* runs `count' guests in parallel, returns the wall clock time */
+static uint64_t
+run_guests(guest_t *guests, int count, bool *ok)
+{
+	uint64_t t1 = abs_time();
+	for (int i = 0; i < count; i++)
+		pthread_create(&guests[i].thread, NULL, run_guest, &guests[i]);
+	for (int i = 0; i < count; i++)
+		pthread_join(guests[i].thread, NULL);
+	uint64_t t2 = abs_time();
+
+	int expected = fib(guests[0].start_no);
+	for (int i = 0; i < count; i++) {
+		if (!guests[i].ok || guests[i].result != expected) {
+			printf("guest %d: result %d, expected %d\n", i,
+				guests[i].result, expected);
+			*ok = false;
+		}
+	}
+	return t2 - t1;
+}
+
+int
+main(int argc, char **argv)
+{
+	guest_t guests[MAX_THREADS];
+	cpu_arch_t arch;
+	int threads = 4;
+	unsigned start_no = START_NO;
+	uint32_t flags_codegen = CPU_CODEGEN_OPTIMIZE;
+
+	if (argc < 3) {
+		printf("Usage: %s arch executable [threads] [itercount] [share]\n", argv[0]);
+		return 0;
+	}
+	if (!strcmp("mips", argv[1]))
+		arch = CPU_ARCH_MIPS;
+	else if (!strcmp("m88k", argv[1]))
+		arch = CPU_ARCH_M88K;
+	else if (!strcmp("arm", argv[1]))
+		arch = CPU_ARCH_ARM;
+	else {
+		printf("unknown architecture '%s'!\n", argv[1]);
+		return 0;
+	}
+	if (argc >= 4)
+		threads = atoi(argv[3]);
+	if (threads < 1 || threads > MAX_THREADS) {
+		printf("threads must be 1..%d\n", MAX_THREADS);
+		return 1;
+	}
+	if (argc >= 5)
+		start_no = atoi(argv[4]);
+	if (argc >= 6 && !strcmp("share", argv[5]))
+		flags_codegen |= CPU_CODEGEN_SHARE;
+
+	for (int i = 0; i < threads; i++) {
+		guests[i].arch = arch;
+		guests[i].executable = argv[2];
+		guests[i].start_no = start_no;
+		guests[i].flags_codegen = flags_codegen;
+	}
+
+	bool ok = true;
+	printf("1 guest..."); fflush(stdout);
+	uint64_t t1 = run_guests(guests, 1, &ok);
+	printf("%lld\n", t1);
+	printf("%d guests on %d threads...", threads, threads); fflush(stdout);
+	uint64_t tn = run_guests(guests, threads, &ok);
+	printf("%lld\n", tn);
+
+	printf("speedup: \033[1m%.2f\033[22m (ideal %d)\n",
+		(float)t1 * threads / (float)tn, threads);
+	if (ok)
+		printf("\033[1mSUCCESS!\033[22m\n\n");
+	else
+		printf("\033[1mFAILED!\033[22m\n\n");
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,6 @@
+# translated code with and without idiom fusion (CPU_CODEGEN_FUSE)
+for f in "" -nofuse; do
+	./build/libcpu/test_fib $f mips test/bin/mips/fibit_mips_be.bin 1000000000
+	./build/libcpu/test_fib $f arm test/bin/arm/fibit_arm.bin 1000000000
+	(cat test/6502/sieve.bas; echo RUN) | time build/libcpu/test_6502 $f test/bin/6502/cbmbasic.bin `cat test/bin/6502/cbmbasic.hints.txt` > /dev/null
+done
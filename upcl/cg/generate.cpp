@@ -549,10 +549,14 @@ cg_generate_arch_callbacks(std::ostream &o, std::string const &arch_name)
 	o << '\t' << "NULL, /* get_pc */" << std::endl;
 	o << '\t' << "NULL, /* emit_decode_reg */" << std::endl;
 	o << '\t' << "NULL, /* spill_reg_state */" << std::endl;
+	o << '\t' << "NULL, /* reload_reg_state */" << std::endl;
 	o << '\t' << "arch_" << arch_name << "_tag_instr," << std::endl;
 	o << '\t' << "arch_" << arch_name << "_disasm_instr," << std::endl;
 	o << '\t' << "arch_" << arch_name << "_translate_cond," << std::endl;
 	o << '\t' << "arch_" << arch_name << "_translate_instr," << std::endl;
+	o << '\t' << "NULL, /* jump_table */" << std::endl;
+	o << '\t' << "NULL, /* cycles */" << std::endl;
+	o << '\t' << "NULL, /* translate_fused */" << std::endl;
 	o << '\t' << "/* idbg support */" << std::endl;
 	o << '\t' << "NULL, /* get_psr */" << std::endl;
 	o << '\t' << "NULL, /* get_reg */" << std::endl;